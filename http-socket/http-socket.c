@@ -34,11 +34,16 @@
 
 #include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 
-#define MAX_PATHLEN 80
 #define MAX_HOSTLEN 40
+/* "xxxx\r\n" before each chunk of a streamed body. */
+#define CHUNK_SIZE_LINE_LEN 6
 PROCESS(http_socket_process, "HTTP socket process");
 LIST(socketlist);
+MEMB(buffers_mem, struct http_socket_buffers, HTTP_SOCKET_BUFFERS);
 
 static void removesocket(struct http_socket *s);
 /*---------------------------------------------------------------------------*/
@@ -56,186 +61,139 @@ call_callback(struct http_socket *s, http_socket_event_t e,
 static void
 parse_header_init(struct http_socket *s)
 {
-    PT_INIT(&s->headerpt);
+    s->parse_state = HTTP_SOCKET_PARSE_STATUS;
+    s->line_len = 0;
+    s->chunked = 0;
+    s->bodylen = 0;
 }
 /*---------------------------------------------------------------------------*/
-static int
-parse_header_byte(struct http_socket *s, char c)
+static const char *
+skip_spaces(const char *p)
 {
-    PT_BEGIN(&s->headerpt);
-
-    memset(&s->header, -1, sizeof(s->header));
-
-    /* Skip the HTTP response */
-    while (c != ' ')
+    while (*p == ' ' || *p == '\t')
     {
-        PT_YIELD(&s->headerpt);
+        p++;
     }
-
-    /* Skip the space */
-    PT_YIELD(&s->headerpt);
-    /* Read three characters of HTTP status and convert to BCD */
-    s->header.status_code = 0;
-    for (s->header_chars = 0; s->header_chars < 3; s->header_chars++)
+    return p;
+}
+/*---------------------------------------------------------------------------*/
+static const char *
+parse_number(const char *p, int64_t *value)
+{
+    p = skip_spaces(p);
+    if (isdigit((int)*p))
     {
-        s->header.status_code = s->header.status_code << 4 | (c - '0');
-        PT_YIELD(&s->headerpt);
+        *value = 0;
+        while (isdigit((int)*p))
+        {
+            *value = *value * 10 + *p - '0';
+            p++;
+        }
     }
+    return skip_spaces(p);
+}
+/*---------------------------------------------------------------------------*/
+/* Returns the value of a header line if its field is the given one. */
+static const char *
+header_value(const char *line, const char *field)
+{
+    int len = strlen(field);
 
-    if (s->header.status_code == 0x200 || s->header.status_code == 0x206)
+    if (strncasecmp(line, field, len) == 0 && line[len] == ':')
     {
-        /* Read headers until data */
+        return skip_spaces(line + len + 1);
+    }
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/* Returns whether a header value contains the given token, ignoring case as
+   field values such as transfer codings are case-insensitive. */
+static int
+has_token(const char *value, const char *token)
+{
+    int len = strlen(token);
 
-        while (1)
+    for (; *value != 0; value++)
+    {
+        if (strncasecmp(value, token, len) == 0)
         {
-            /* Skip characters until end of line */
-            do
-            {
-                while (c != '\r')
-                {
-                    s->header_chars++;
-                    PT_YIELD(&s->headerpt);
-                }
-                s->header_chars++;
-                PT_YIELD(&s->headerpt);
-            } while (c != '\n');
-            s->header_chars--;
-            PT_YIELD(&s->headerpt);
+            return 1;
+        }
+    }
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+parse_header_line(struct http_socket *s, const char *line)
+{
+    const char *value;
 
-            if (s->header_chars == 0)
+    if ((value = header_value(line, "Content-Length")) != NULL)
+    {
+        parse_number(value, &s->header.content_length);
+    }
+    else if ((value = header_value(line, "Content-Range")) != NULL)
+    {
+        /* Skip the bytes-unit token */
+        while (*value != ' ' && *value != '\t' && *value != 0)
+        {
+            value++;
+        }
+        value = parse_number(value, &s->header.content_range.first_byte_pos);
+        if (*value == '-')
+        {
+            value = parse_number(value + 1,
+                                 &s->header.content_range.last_byte_pos);
+            if (*value == '/')
             {
-                /* This was an empty line, i.e. the end of headers */
-                break;
+                parse_number(value + 1,
+                             &s->header.content_range.instance_length);
             }
+        }
+    }
+    else if ((value = header_value(line, "Transfer-Encoding")) != NULL)
+    {
+        s->chunked = has_token(value, "chunked");
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* Handles a complete line of the response, without its CRLF. Returns 0 if
+   the socket was closed. */
+static int
+parse_line(struct http_socket *s, const char *line)
+{
+    const char *p;
+    int i;
 
-            /* Start of line */
-            s->header_chars = 0;
+    switch (s->parse_state)
+    {
+    case HTTP_SOCKET_PARSE_STATUS:
+        memset(&s->header, -1, sizeof(s->header));
 
-            /* Read header field */
-            while (c != ' ' && c != '\t' && c != ':' && c != '\r' &&
-                   s->header_chars < sizeof(s->header_field) - 1)
-            {
-                s->header_field[s->header_chars++] = c;
-                PT_YIELD(&s->headerpt);
-            }
-            s->header_field[s->header_chars] = '\0';
-            /* Skip linear white spaces */
-            while (c == ' ' || c == '\t')
-            {
-                s->header_chars++;
-                PT_YIELD(&s->headerpt);
-            }
-            if (c == ':')
-            {
-                /* Skip the colon */
-                s->header_chars++;
-                PT_YIELD(&s->headerpt);
-                /* Skip linear white spaces */
-                while (c == ' ' || c == '\t')
-                {
-                    s->header_chars++;
-                    PT_YIELD(&s->headerpt);
-                }
-                if (!strcmp(s->header_field, "Content-Length"))
-                {
-                    s->header.content_length = 0;
-                    while (isdigit((int)c))
-                    {
-                        s->header.content_length = s->header.content_length * 10 + c - '0';
-                        s->header_chars++;
-                        PT_YIELD(&s->headerpt);
-                    }
-                }
-                else if (!strcmp(s->header_field, "Content-Range"))
-                {
-                    /* Skip the bytes-unit token */
-                    while (c != ' ' && c != '\t')
-                    {
-                        s->header_chars++;
-                        PT_YIELD(&s->headerpt);
-                    }
-                    /* Skip linear white spaces */
-                    while (c == ' ' || c == '\t')
-                    {
-                        s->header_chars++;
-                        PT_YIELD(&s->headerpt);
-                    }
-                    s->header.content_range.first_byte_pos = 0;
-                    while (isdigit((int)c))
-                    {
-                        s->header.content_range.first_byte_pos =
-                            s->header.content_range.first_byte_pos * 10 + c - '0';
-                        s->header_chars++;
-                        PT_YIELD(&s->headerpt);
-                    }
-                    /* Skip linear white spaces */
-                    while (c == ' ' || c == '\t')
-                    {
-                        s->header_chars++;
-                        PT_YIELD(&s->headerpt);
-                    }
-                    if (c == '-')
-                    {
-                        /* Skip the dash */
-                        s->header_chars++;
-                        PT_YIELD(&s->headerpt);
-                        /* Skip linear white spaces */
-                        while (c == ' ' || c == '\t')
-                        {
-                            s->header_chars++;
-                            PT_YIELD(&s->headerpt);
-                        }
-                        s->header.content_range.last_byte_pos = 0;
-                        while (isdigit((int)c))
-                        {
-                            s->header.content_range.last_byte_pos =
-                                s->header.content_range.last_byte_pos * 10 + c - '0';
-                            s->header_chars++;
-                            PT_YIELD(&s->headerpt);
-                        }
-                        /* Skip linear white spaces */
-                        while (c == ' ' || c == '\t')
-                        {
-                            s->header_chars++;
-                            PT_YIELD(&s->headerpt);
-                        }
-                        if (c == '/')
-                        {
-                            /* Skip the slash */
-                            s->header_chars++;
-                            PT_YIELD(&s->headerpt);
-                            /* Skip linear white spaces */
-                            while (c == ' ' || c == '\t')
-                            {
-                                s->header_chars++;
-                                PT_YIELD(&s->headerpt);
-                            }
-                            if (c != '*')
-                            {
-                                s->header.content_range.instance_length = 0;
-                                while (isdigit((int)c))
-                                {
-                                    s->header.content_range.instance_length =
-                                        s->header.content_range.instance_length * 10 + c - '0';
-                                    s->header_chars++;
-                                    PT_YIELD(&s->headerpt);
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+        /* Read three characters of HTTP status and convert to BCD */
+        s->header.status_code = 0;
+        p = strchr(line, ' ');
+        for (i = 0; p != NULL && i < 3 && isdigit((int)p[i + 1]); i++)
+        {
+            s->header.status_code = s->header.status_code << 4 | (p[i + 1] - '0');
         }
 
-        /* All headers read, now read data */
-        call_callback(s, HTTP_SOCKET_HEADER, (void *)&s->header, sizeof(s->header));
+        if ((s->header.status_code == 0x200 || s->header.status_code == 0x206) &&
+            s->response_mode == HTTP_SOCKET_RESPONSE_STATUS)
+        {
+            /* Nothing else is wanted from this response. */
+            s->parse_state = HTTP_SOCKET_PARSE_DONE;
+            call_callback(s, HTTP_SOCKET_HEADER, (void *)&s->header, sizeof(s->header));
+            tcp_socket_close(&s->s);
+            return 0;
+        }
+
+        if (s->header.status_code == 0x200 || s->header.status_code == 0x206)
+        {
+            s->parse_state = HTTP_SOCKET_PARSE_HEADERS;
+            return 1;
+        }
 
-        /* Should exit the pt here to indicate that all headers have been
-       read */
-        PT_EXIT(&s->headerpt);
-    }
-    else
-    {
         if (s->header.status_code == 0x404)
         {
             printf("File not found\n");
@@ -245,74 +203,250 @@ parse_header_byte(struct http_socket *s, char c)
             printf("File moved (not handled)\n");
         }
 
+        s->parse_state = HTTP_SOCKET_PARSE_DONE;
         call_callback(s, HTTP_SOCKET_ERR, (void *)&s->header, sizeof(s->header));
         tcp_socket_close(&s->s);
         removesocket(s);
-        PT_EXIT(&s->headerpt);
-    }
+        return 0;
+
+    case HTTP_SOCKET_PARSE_HEADERS:
+        if (*line != 0)
+        {
+            parse_header_line(s, line);
+            return 1;
+        }
+
+        /* This was an empty line, i.e. the end of headers */
+        call_callback(s, HTTP_SOCKET_HEADER, (void *)&s->header, sizeof(s->header));
 
-    PT_END(&s->headerpt);
+        if (s->chunked)
+        {
+            s->parse_state = HTTP_SOCKET_PARSE_CHUNK_SIZE;
+        }
+        else if (s->header.content_length == 0)
+        {
+            /* Nothing else to wait for. */
+            s->parse_state = HTTP_SOCKET_PARSE_DONE;
+            tcp_socket_close(&s->s);
+        }
+        else
+        {
+            s->parse_state = HTTP_SOCKET_PARSE_BODY;
+        }
+        return 1;
+
+    case HTTP_SOCKET_PARSE_CHUNK_SIZE:
+        /* Chunk extensions after the size are ignored */
+        s->chunk_remaining = strtoul(line, NULL, 16);
+        s->parse_state = s->chunk_remaining > 0 ?
+            HTTP_SOCKET_PARSE_CHUNK_DATA : HTTP_SOCKET_PARSE_TRAILER;
+        return 1;
+
+    case HTTP_SOCKET_PARSE_CHUNK_END:
+        /* The CRLF that follows the data of a chunk */
+        s->parse_state = HTTP_SOCKET_PARSE_CHUNK_SIZE;
+        return 1;
+
+    case HTTP_SOCKET_PARSE_TRAILER:
+        if (*line == 0)
+        {
+            /* The terminal chunk, the response is complete. */
+            s->parse_state = HTTP_SOCKET_PARSE_DONE;
+            tcp_socket_close(&s->s);
+        }
+        return 1;
+
+    default:
+        return 1;
+    }
 }
 /*---------------------------------------------------------------------------*/
-static int
-input_pt(struct http_socket *s,
-         const uint8_t *inputptr, int inputdatalen)
+/* Parses a received segment. Lines are scanned for in bulk and only the
+   bytes of the current line are kept between segments. */
+static void
+parse_input(struct http_socket *s, const uint8_t *inputptr, int inputdatalen)
 {
-    int i;
-    PT_BEGIN(&s->pt);
+    const uint8_t *eol;
+    int len;
+    int n;
 
-    /* Parse the header */
-    s->header_received = 0;
-    do
+    while (inputdatalen > 0)
     {
-        for (i = 0; i < inputdatalen; i++)
+        if (s->parse_state == HTTP_SOCKET_PARSE_DONE)
         {
-            if (!PT_SCHEDULE(parse_header_byte(s, inputptr[i])))
+            return;
+        }
+
+        if (s->parse_state == HTTP_SOCKET_PARSE_BODY ||
+            s->parse_state == HTTP_SOCKET_PARSE_CHUNK_DATA)
+        {
+            len = inputdatalen;
+            if (s->parse_state == HTTP_SOCKET_PARSE_CHUNK_DATA &&
+                len > s->chunk_remaining)
+            {
+                len = s->chunk_remaining;
+            }
+
+            /* Receive the data, without copying it. The body is read but
+               discarded in the other modes. */
+            if (s->response_mode == HTTP_SOCKET_RESPONSE_BODY)
+            {
+                if (s->sink != NULL)
+                {
+                    s->sink(s, s->sinkptr, inputptr, len);
+                }
+                else
+                {
+                    call_callback(s, HTTP_SOCKET_DATA, inputptr, len);
+                }
+            }
+            s->bodylen += len;
+            inputptr += len;
+            inputdatalen -= len;
+
+            if (s->parse_state == HTTP_SOCKET_PARSE_CHUNK_DATA)
+            {
+                s->chunk_remaining -= len;
+                if (s->chunk_remaining == 0)
+                {
+                    s->parse_state = HTTP_SOCKET_PARSE_CHUNK_END;
+                }
+            }
+            else if (s->header.content_length >= 0 &&
+                     s->bodylen >= s->header.content_length)
             {
-                s->header_received = 1;
-                break;
+                /* Close the connection if the expected content length has
+                   been received */
+                s->parse_state = HTTP_SOCKET_PARSE_DONE;
+                tcp_socket_close(&s->s);
             }
+            continue;
         }
-        inputdatalen -= i;
-        inputptr += i;
 
-        if (s->header_received == 0)
+        eol = memchr(inputptr, '\n', inputdatalen);
+        len = eol != NULL ? eol - inputptr + 1 : inputdatalen;
+
+        /* Keep what fits of the line, longer lines are cut. */
+        n = len;
+        if (n > sizeof(s->line) - 1 - s->line_len)
         {
-            /* If we have not yet received the full header, we wait for the
-         next packet to arrive. */
-            PT_YIELD(&s->pt);
+            n = sizeof(s->line) - 1 - s->line_len;
         }
-    } while (s->header_received == 0);
-
-    s->bodylen = 0;
-    do
-    {
-        /* Receive the data */
-        call_callback(s, HTTP_SOCKET_DATA, inputptr, inputdatalen);
+        memcpy(s->line + s->line_len, inputptr, n);
+        s->line_len += n;
+        inputptr += len;
+        inputdatalen -= len;
 
-        /* Close the connection if the expected content length has been received */
-        if (s->header.content_length >= 0 && s->bodylen < s->header.content_length)
+        if (eol != NULL)
         {
-            s->bodylen += inputdatalen;
-            if (s->bodylen >= s->header.content_length)
+            while (s->line_len > 0 &&
+                   (s->line[s->line_len - 1] == '\n' ||
+                    s->line[s->line_len - 1] == '\r'))
             {
-                tcp_socket_close(&s->s);
+                s->line_len--;
+            }
+            s->line[s->line_len] = 0;
+            s->line_len = 0;
+
+            if (!parse_line(s, s->line))
+            {
+                return;
             }
         }
+    }
+}
+/*---------------------------------------------------------------------------*/
+/* Returns the time left until a deadline, 0 if it has passed. */
+static clock_time_t
+time_left(clock_time_t since, clock_time_t timeout, clock_time_t now)
+{
+    return now - since >= timeout ? 0 : timeout - (now - since);
+}
+/*---------------------------------------------------------------------------*/
+/* Checks the deadlines of a socket. Returns the event of the first one that
+   has passed, or HTTP_SOCKET_OK and the time left until the next one in
+   next (0 if there is none). */
+static http_socket_event_t
+check_deadlines(struct http_socket *s, clock_time_t *next)
+{
+    clock_time_t now = clock_time();
+    clock_time_t left;
+    /* The deadlines bound the request up to its response, not the close
+       that follows it. */
+    int answered = s->parse_state == HTTP_SOCKET_PARSE_DONE;
 
-        PT_YIELD(&s->pt);
-    } while (inputdatalen > 0);
+    *next = 0;
 
-    PT_END(&s->pt);
+    if (s->total_timeout && !answered)
+    {
+        left = time_left(s->start_time, s->total_timeout, now);
+        if (left == 0)
+        {
+            return HTTP_SOCKET_DEADLINE_EXCEEDED;
+        }
+        *next = left;
+    }
+    if (s->connect_timeout && !s->connected && !answered)
+    {
+        left = time_left(s->start_time, s->connect_timeout, now);
+        if (left == 0)
+        {
+            return HTTP_SOCKET_CONNECT_TIMEDOUT;
+        }
+        *next = *next == 0 ? left : MIN(*next, left);
+    }
+    if (s->response_timeout && s->request_sent && !s->response_started &&
+        !answered)
+    {
+        left = time_left(s->sent_time, s->response_timeout, now);
+        if (left == 0)
+        {
+            return HTTP_SOCKET_RESPONSE_TIMEDOUT;
+        }
+        *next = *next == 0 ? left : MIN(*next, left);
+    }
+    if (s->timeout_timer_started)
+    {
+        left = time_left(s->activity_time, HTTP_SOCKET_TIMEOUT, now);
+        if (left == 0)
+        {
+            return HTTP_SOCKET_TIMEDOUT;
+        }
+        *next = *next == 0 ? left : MIN(*next, left);
+    }
+    return HTTP_SOCKET_OK;
 }
 /*---------------------------------------------------------------------------*/
+/* Sets the timer of a socket to its next deadline. */
 static void
-start_timeout_timer(struct http_socket *s)
+set_timeout_timer(struct http_socket *s)
 {
+    clock_time_t next;
+
+    if (check_deadlines(s, &next) != HTTP_SOCKET_OK)
+    {
+        /* Already passed, expire at once. */
+        next = 1;
+    }
+
     PROCESS_CONTEXT_BEGIN(&http_socket_process);
-    etimer_set(&s->timeout_timer, HTTP_SOCKET_TIMEOUT);
+    if (next > 0)
+    {
+        etimer_set(&s->timeout_timer, next);
+    }
+    else
+    {
+        etimer_stop(&s->timeout_timer);
+    }
     PROCESS_CONTEXT_END(&http_socket_process);
+}
+/*---------------------------------------------------------------------------*/
+static void
+start_timeout_timer(struct http_socket *s)
+{
+    s->activity_time = clock_time();
     s->timeout_timer_started = 1;
+    set_timeout_timer(s);
 }
 /*---------------------------------------------------------------------------*/
 static int
@@ -321,18 +455,25 @@ input(struct tcp_socket *tcps, void *ptr,
 {
     struct http_socket *s = ptr;
 
-    input_pt(s, inputptr, inputdatalen);
-    start_timeout_timer(s);
+    s->response_started = 1;
+    parse_input(s, inputptr, inputdatalen);
+    if (s->parse_state != HTTP_SOCKET_PARSE_DONE)
+    {
+        start_timeout_timer(s);
+    }
 
     return 0; /* all data consumed */
 }
 /*---------------------------------------------------------------------------*/
+/* Parses the url of a request and stores its host and path in s->buf->url, each
+   one NUL terminated, so it is done only once for each request. */
 static int
-parse_url(const char *url, char *host, uint16_t *portptr, char *path)
+parse_url(struct http_socket *s, const char *url)
 {
     const char *urlptr;
-    int i;
+    const char *host;
     const char *file;
+    int hostlen;
     uint16_t port;
 
     if (url == NULL)
@@ -342,7 +483,7 @@ parse_url(const char *url, char *host, uint16_t *portptr, char *path)
     }
 
     /* Don't even try to go further if the URL is empty. */
-    if (strlen(url) == 0)
+    if (*url == 0)
     {
         printf("empty url\n");
         return 0;
@@ -363,51 +504,35 @@ parse_url(const char *url, char *host, uint16_t *portptr, char *path)
     if (*urlptr == '[')
     {
         /* Handle IPv6 addresses - scan for matching ']' */
-        urlptr++;
-        for (i = 0; i < MAX_HOSTLEN; ++i)
+        host = ++urlptr;
+        while (*urlptr != ']' && *urlptr != 0)
         {
-            if (*urlptr == ']')
-            {
-                if (host != NULL)
-                {
-                    host[i] = 0;
-                }
-                urlptr++;
-                break;
-            }
-            if (host != NULL)
-            {
-                host[i] = *urlptr;
-            }
             ++urlptr;
         }
+        if (*urlptr != ']')
+        {
+            printf("invalid url\n");
+            return 0;
+        }
+        hostlen = urlptr - host;
+        urlptr++;
     }
     else
     {
-        for (i = 0; i < MAX_HOSTLEN; ++i)
+        host = urlptr;
+        while (*urlptr != 0 &&
+               *urlptr != '/' &&
+               *urlptr != ' ' &&
+               *urlptr != ':')
         {
-            if (*urlptr == 0 ||
-                *urlptr == '/' ||
-                *urlptr == ' ' ||
-                *urlptr == ':')
-            {
-                if (host != NULL)
-                {
-                    host[i] = 0;
-                }
-                break;
-            }
-            if (host != NULL)
-            {
-                host[i] = *urlptr;
-            }
             ++urlptr;
         }
+        hostlen = urlptr - host;
     }
 
-    /* check if host is null terminated */
-    if (!memchr(host, 0, MAX_HOSTLEN))
+    if (hostlen == 0 || hostlen >= MAX_HOSTLEN)
     {
+        printf("invalid url host\n");
         return 0;
     }
 
@@ -426,10 +551,7 @@ parse_url(const char *url, char *host, uint16_t *portptr, char *path)
         } while (*urlptr >= '0' &&
                  *urlptr <= '9');
     }
-    if (portptr != NULL)
-    {
-        *portptr = port;
-    }
+
     /* Find file part of the URL. */
     while (*urlptr != '/' && *urlptr != 0)
     {
@@ -443,10 +565,96 @@ parse_url(const char *url, char *host, uint16_t *portptr, char *path)
     {
         file = "/";
     }
-    if (path != NULL)
+
+    if (hostlen + 1 + strlen(file) + 1 > sizeof(s->buf->url))
     {
-        strncpy(path, file, MAX_PATHLEN);
+        printf("url too long\n");
+        return 0;
     }
+
+    memcpy(s->buf->url, host, hostlen);
+    s->buf->url[hostlen] = 0;
+    strcpy(s->buf->url + hostlen + 1, file);
+    s->path_offset = hostlen + 1;
+    s->port = port;
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* Sends as much of the request body as fits in the output buffer. Returns 1
+   once the whole body has been queued, or -1 if a streamed body does not
+   match its Content-Length. */
+static int
+send_body(struct http_socket *s)
+{
+    uint8_t *buf;
+    uint8_t *data;
+    char str[8];
+    int chunked = s->body_length == HTTP_SOCKET_LENGTH_UNKNOWN;
+    int room;
+    int len;
+
+    if (s->postdata != NULL && s->postdatalen)
+    {
+        len = tcp_socket_send(&s->s, s->postdata, s->postdatalen);
+        s->postdata += len;
+        s->postdatalen -= len;
+        return s->postdatalen == 0;
+    }
+
+    while (s->producer != NULL && !s->body_done)
+    {
+        /* The producer writes straight into the free space of the output
+           buffer, which is then queued where it is. */
+        room = tcp_socket_max_sendlen(&s->s);
+        buf = s->buf->outputbuf + sizeof(s->buf->outputbuf) - room;
+        data = buf;
+        if (chunked)
+        {
+            /* Leave room for the chunk size line, written once the size is
+               known, and the CRLF after the data. */
+            data += CHUNK_SIZE_LINE_LEN;
+            room -= CHUNK_SIZE_LINE_LEN + 2;
+        }
+        if (room <= 0)
+        {
+            /* Continue when the queued data has been sent. */
+            return 0;
+        }
+
+        len = s->producer(s, s->callbackptr, data, room);
+
+        if (!chunked)
+        {
+            s->body_sent += len;
+            if (s->body_sent > s->body_length ||
+                (len == 0 && s->body_sent != s->body_length))
+            {
+                return -1;
+            }
+            tcp_socket_send(&s->s, buf, len);
+        }
+        else if (len > 0)
+        {
+            /* Leading zeros are allowed in the chunk size, so its line has
+               always the same length. */
+            sprintf(str, "%04x\r\n", len);
+            memcpy(buf, str, CHUNK_SIZE_LINE_LEN);
+            data[len] = '\r';
+            data[len + 1] = '\n';
+            tcp_socket_send(&s->s, buf, CHUNK_SIZE_LINE_LEN + len + 2);
+        }
+        else
+        {
+            /* Last chunk. */
+            tcp_socket_send_str(&s->s, "0\r\n\r\n");
+        }
+
+        if (len == 0)
+        {
+            s->body_done = 1;
+        }
+    }
+
     return 1;
 }
 /*---------------------------------------------------------------------------*/
@@ -456,118 +664,288 @@ removesocket(struct http_socket *s)
     etimer_stop(&s->timeout_timer);
     s->timeout_timer_started = 0;
     list_remove(socketlist, s);
+
+    /* Give the buffers back to the pool, the tcp socket must not use them
+       anymore. */
+    if (s->buf != NULL)
+    {
+        tcp_socket_unregister(&s->s);
+        memb_free(&buffers_mem, s->buf);
+        s->buf = NULL;
+    }
 }
 /*---------------------------------------------------------------------------*/
+/* Closes a request that can not be sent as it was asked and reports it. The
+   socket is freed first, so the callback can start a new request on it. */
 static void
-event(struct tcp_socket *tcps, void *ptr,
-      tcp_socket_event_t e)
+abort_request(struct http_socket *s)
 {
-    struct http_socket *s = ptr;
-    char host[MAX_HOSTLEN];
-    char path[MAX_PATHLEN];
-    uint16_t port;
-    char str[42];
-    int len;
+    tcp_socket_close(&s->s);
+    removesocket(s);
+    call_callback(s, HTTP_SOCKET_ERR, NULL, 0);
+}
+/*---------------------------------------------------------------------------*/
+/* Appends str to the preamble of a header set, returns 0 if it does not
+   fit. */
+static int
+append_preamble(struct http_socket_header_set *set, const char *str)
+{
+    uint16_t len = strlen(str);
 
-    if (e == TCP_SOCKET_CONNECTED)
+    if (set->len + len > sizeof(set->preamble))
     {
-        printf("Connected\n");
+        return 0;
+    }
+    memcpy(set->preamble + set->len, str, len);
+    set->len += len;
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* Appends a host, between brackets if it is an IPv6 address as in rfc2732,
+   and returns the offset where its name starts or 0 if it does not fit. */
+static uint16_t
+append_host(struct http_socket_header_set *set, const char *host)
+{
+    uint8_t ipv6 = strchr(host, ':') != NULL;
+    uint16_t offset;
+
+    if (ipv6 && !append_preamble(set, "["))
+    {
+        return 0;
+    }
+    offset = set->len;
+    if (!append_preamble(set, host) ||
+        (ipv6 && !append_preamble(set, "]")))
+    {
+        return 0;
+    }
+    return offset;
+}
+/*---------------------------------------------------------------------------*/
+/* Formats the preamble of the request of a socket in its header set. The
+   path is not part of it, it is sent between the two halves. Returns 0 if
+   it does not fit. */
+static int
+build_preamble(struct http_socket *s, struct http_socket_header_set *set)
+{
+    const char *host = s->buf->url;
+    char str[8];
+    uint8_t i;
+    int ok;
+
+    set->len = 0;
+    ok = append_preamble(set, get_method_string(s->method)) &&
+         append_preamble(set, " ");
 
-        if (parse_url(s->url, host, &port, path))
+    if (ok && s->proxy_port != 0)
+    {
+        /* If we are configured to route through a proxy, we should provide
+           the full URL as the path. */
+        ok = append_preamble(set, "http://") && append_host(set, host);
+        if (ok && s->port != 80)
         {
+            sprintf(str, ":%u", s->port);
+            ok = append_preamble(set, str);
+        }
+    }
+    set->path_offset = set->len;
 
-            switch (s->method)
-            {
-            case HTTP_SOCKET_METHOD_GET:
-                tcp_socket_send_str(tcps, "GET ");
-                break;
-            case HTTP_SOCKET_METHOD_POST:
-                tcp_socket_send_str(tcps, "POST ");
-                break;
-            case HTTP_SOCKET_METHOD_PUT:
-                tcp_socket_send_str(tcps, "PUT ");
-                break;
-            case HTTP_SOCKET_METHOD_DELETE:
-                tcp_socket_send_str(tcps, "DELETE ");
-                break;
-            default:
-                // invalid method, abort request.
-                return;
-            }
+    ok = ok && append_preamble(set, " HTTP/1.1\r\nConnection: close\r\nHost: ");
+    set->host_offset = ok ? append_host(set, host) : 0;
+    ok = set->host_offset != 0 && append_preamble(set, "\r\n");
+
+    for (i = 0; ok && i < set->count; i++)
+    {
+        ok = append_preamble(set, set->headers[i]) &&
+             append_preamble(set, "\r\n");
+    }
+
+    if (!ok)
+    {
+        set->len = 0;
+        return 0;
+    }
 
-            if (s->proxy_port != 0)
+    set->method = s->method;
+    set->port = s->port;
+    set->proxied = s->proxy_port != 0;
+    set->host_len = strlen(host);
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* Whether the cached preamble of a header set is the one of the request of
+   a socket. */
+static int
+preamble_matches(struct http_socket *s, struct http_socket_header_set *set)
+{
+    const char *host = s->buf->url;
+
+    return set->len > 0 &&
+           set->method == s->method &&
+           set->port == s->port &&
+           set->proxied == (s->proxy_port != 0) &&
+           set->host_len == strlen(host) &&
+           memcmp(set->preamble + set->host_offset, host, set->host_len) == 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Sends the request line and the headers that do not depend on the body.
+   Returns 0 if the method is not valid. */
+static int
+send_preamble(struct http_socket *s)
+{
+    struct tcp_socket *tcps = &s->s;
+    struct http_socket_header_set *set = s->header_set;
+    const char *host = s->buf->url;
+    const char *path = s->buf->url + s->path_offset;
+    char str[8];
+    uint8_t i;
+
+    if (s->method > HTTP_SOCKET_METHOD_DELETE)
+    {
+        return 0;
+    }
+
+    if (set != NULL && (preamble_matches(s, set) || build_preamble(s, set)))
+    {
+        tcp_socket_send(tcps, (const uint8_t *)set->preamble, set->path_offset);
+        tcp_socket_send_str(tcps, path);
+        tcp_socket_send(tcps, (const uint8_t *)set->preamble + set->path_offset,
+                        set->len - set->path_offset);
+    }
+    else
+    {
+        /* No header set, or its preamble is too long to be cached. */
+        tcp_socket_send_str(tcps, get_method_string(s->method));
+        tcp_socket_send_str(tcps, " ");
+
+        if (s->proxy_port != 0)
+        {
+            /* If we are configured to route through a proxy, we should
+               provide the full URL as the path. */
+            tcp_socket_send_str(tcps, "http://");
+            if (strchr(host, ':') != NULL)
             {
-                /* If we are configured to route through a proxy, we should
-           provide the full URL as the path. */
-                tcp_socket_send_str(tcps, s->url);
+                tcp_socket_send_str(tcps, "[");
+                tcp_socket_send_str(tcps, host);
+                tcp_socket_send_str(tcps, "]");
             }
             else
             {
-                tcp_socket_send_str(tcps, path);
-            }
-            tcp_socket_send_str(tcps, " HTTP/1.1\r\n");
-            tcp_socket_send_str(tcps, "Connection: close\r\n");
-            tcp_socket_send_str(tcps, "Host: ");
-            /* If we have IPv6 host, add the '[' and the ']' characters
-         to the host. As in rfc2732. */
-            if (memchr(host, ':', MAX_HOSTLEN))
-            {
-                tcp_socket_send_str(tcps, "[");
+                tcp_socket_send_str(tcps, host);
             }
-            tcp_socket_send_str(tcps, host);
-            if (memchr(host, ':', MAX_HOSTLEN))
+            if (s->port != 80)
             {
-                tcp_socket_send_str(tcps, "]");
+                sprintf(str, ":%u", s->port);
+                tcp_socket_send_str(tcps, str);
             }
+        }
+        tcp_socket_send_str(tcps, path);
+        tcp_socket_send_str(tcps, " HTTP/1.1\r\n");
+        tcp_socket_send_str(tcps, "Connection: close\r\n");
+        tcp_socket_send_str(tcps, "Host: ");
+        /* If we have IPv6 host, add the '[' and the ']' characters
+           to the host. As in rfc2732. */
+        if (strchr(host, ':') != NULL)
+        {
+            tcp_socket_send_str(tcps, "[");
+        }
+        tcp_socket_send_str(tcps, host);
+        if (strchr(host, ':') != NULL)
+        {
+            tcp_socket_send_str(tcps, "]");
+        }
+        tcp_socket_send_str(tcps, "\r\n");
+
+        for (i = 0; set != NULL && i < set->count; i++)
+        {
+            tcp_socket_send_str(tcps, set->headers[i]);
             tcp_socket_send_str(tcps, "\r\n");
+        }
+    }
+
+    if (strlen(s->custom_header) > 0)
+    {
+        tcp_socket_send_str(tcps, s->custom_header);
+        tcp_socket_send_str(tcps, "\r\n");
+    }
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+event(struct tcp_socket *tcps, void *ptr,
+      tcp_socket_event_t e)
+{
+    struct http_socket *s = ptr;
+    char str[42];
+    int ret;
+
+    if (e == TCP_SOCKET_CONNECTED)
+    {
+        printf("Connected\n");
+        s->connected = 1;
+        set_timeout_timer(s);
+
+        if (!send_preamble(s))
+        {
+            /* Invalid method, abort the request. */
+            abort_request(s);
+            return;
+        }
 
-            if (strlen(s->custom_header) > 0)
+        if (s->postdata != NULL || s->producer != NULL)
+        {
+            if (s->content_type)
             {
-                tcp_socket_send_str(tcps, s->custom_header);
+                tcp_socket_send_str(tcps, "Content-Type: ");
+                tcp_socket_send_str(tcps, s->content_type);
                 tcp_socket_send_str(tcps, "\r\n");
             }
-
-            if (s->postdata != NULL)
+            if (s->producer != NULL &&
+                s->body_length == HTTP_SOCKET_LENGTH_UNKNOWN)
             {
-                if (s->content_type)
+                tcp_socket_send_str(tcps, "Transfer-Encoding: chunked\r\n");
+            }
+            else
+            {
+                tcp_socket_send_str(tcps, "Content-Length: ");
+                if (s->producer != NULL)
                 {
-                    tcp_socket_send_str(tcps, "Content-Type: ");
-                    tcp_socket_send_str(tcps, s->content_type);
-                    tcp_socket_send_str(tcps, "\r\n");
+                    sprintf(str, "%lu", (unsigned long)s->body_length);
+                }
+                else
+                {
+                    sprintf(str, "%u", s->postdatalen);
                 }
-                tcp_socket_send_str(tcps, "Content-Length: ");
-                sprintf(str, "%u", s->postdatalen);
                 tcp_socket_send_str(tcps, str);
                 tcp_socket_send_str(tcps, "\r\n");
             }
-            else if (s->length || s->pos > 0)
+        }
+        else if (s->length || s->pos > 0)
+        {
+            tcp_socket_send_str(tcps, "Range: bytes=");
+            if (s->length)
             {
-                tcp_socket_send_str(tcps, "Range: bytes=");
-                if (s->length)
+                if (s->pos >= 0)
                 {
-                    if (s->pos >= 0)
-                    {
-                        sprintf(str, "%llu-%llu", s->pos, s->pos + s->length - 1);
-                    }
-                    else
-                    {
-                        sprintf(str, "-%llu", s->length);
-                    }
+                    sprintf(str, "%llu-%llu", s->pos, s->pos + s->length - 1);
                 }
                 else
                 {
-                    sprintf(str, "%llu-", s->pos);
+                    sprintf(str, "-%llu", s->length);
                 }
-                tcp_socket_send_str(tcps, str);
-                tcp_socket_send_str(tcps, "\r\n");
             }
-            tcp_socket_send_str(tcps, "\r\n");
-            if (s->postdata != NULL && s->postdatalen)
+            else
             {
-                len = tcp_socket_send(tcps, s->postdata, s->postdatalen);
-                s->postdata += len;
-                s->postdatalen -= len;
+                sprintf(str, "%llu-", s->pos);
             }
+            tcp_socket_send_str(tcps, str);
+            tcp_socket_send_str(tcps, "\r\n");
+        }
+        tcp_socket_send_str(tcps, "\r\n");
+        if (send_body(s) < 0)
+        {
+            abort_request(s);
+            return;
         }
         parse_header_init(s);
     }
@@ -591,14 +969,18 @@ event(struct tcp_socket *tcps, void *ptr,
     }
     else if (e == TCP_SOCKET_DATA_SENT)
     {
-        if (s->postdata != NULL && s->postdatalen)
+        ret = send_body(s);
+        if (ret < 0)
         {
-            len = tcp_socket_send(tcps, s->postdata, s->postdatalen);
-            s->postdata += len;
-            s->postdatalen -= len;
+            abort_request(s);
         }
-        else
+        else if (ret)
         {
+            if (!s->request_sent)
+            {
+                s->request_sent = 1;
+                s->sent_time = clock_time();
+            }
             start_timeout_timer(s);
         }
     }
@@ -610,62 +992,68 @@ start_request(struct http_socket *s)
     uip_ip4addr_t ip4addr;
     uip_ip6addr_t ip6addr;
     uip_ip6addr_t *addr;
-    char host[MAX_HOSTLEN];
-    char path[MAX_PATHLEN];
-    uint16_t port;
+    const char *host = s->buf->url;
+    uint16_t port = s->port;
     int ret;
 
-    if (parse_url(s->url, host, &port, path))
-    {
-
-        printf("HTTP REQUEST\nurl: %s\nhost: %s\nport: %d\npath: %s\nmethod: %s\n",
-            s->url, host, port, path, get_method_string(s->method));
+    printf("HTTP REQUEST\nhost: %s\nport: %d\npath: %s\nmethod: %s\n",
+        host, port, s->buf->url + s->path_offset, get_method_string(s->method));
 
-        /* Check if we are to route the request through a proxy. */
-        if (s->proxy_port != 0)
+    /* Check if we are to route the request through a proxy. */
+    if (s->proxy_port != 0)
+    {
+        /* The proxy address should be an IPv6 address. */
+        uip_ip6addr_copy(&ip6addr, &s->proxy_addr);
+        port = s->proxy_port;
+    }
+    else if (s->has_host_addr)
+    {
+        /* The caller already knows the address of the host. */
+        uip_ip6addr_copy(&ip6addr, &s->host_addr);
+    }
+    else if (uiplib_ip6addrconv(host, &ip6addr) == 0)
+    {
+        /* First check if the host is an IP address. */
+        if (uiplib_ip4addrconv(host, &ip4addr) != 0)
         {
-            /* The proxy address should be an IPv6 address. */
-            uip_ip6addr_copy(&ip6addr, &s->proxy_addr);
-            port = s->proxy_port;
+            ip64_addr_4to6(&ip4addr, &ip6addr);
         }
-        else if (uiplib_ip6addrconv(host, &ip6addr) == 0)
+        else
         {
-            /* First check if the host is an IP address. */
-            if (uiplib_ip4addrconv(host, &ip4addr) != 0)
+            /* Try to lookup the hostname. If it fails, we initiate a hostname
+         lookup. */
+            ret = resolv_lookup(host, &addr);
+            if (ret == RESOLV_STATUS_UNCACHED ||
+                ret == RESOLV_STATUS_EXPIRED)
+            {
+                resolv_query(host);
+                puts("Resolving host...");
+                return HTTP_SOCKET_OK;
+            }
+            if (ret == RESOLV_STATUS_RESOLVING)
+            {
+                /* A query for this host is already running, wait for its
+           answer instead of starting it again. */
+                puts("Waiting for host...");
+                return HTTP_SOCKET_OK;
+            }
+            if (addr != NULL)
             {
-                ip64_addr_4to6(&ip4addr, &ip6addr);
+                s->did_tcp_connect = 1;
+                tcp_socket_connect(&s->s, addr, port);
+                return HTTP_SOCKET_OK;
             }
             else
             {
-                /* Try to lookup the hostname. If it fails, we initiate a hostname
-           lookup. */
-                ret = resolv_lookup(host, &addr);
-                if (ret == RESOLV_STATUS_UNCACHED ||
-                    ret == RESOLV_STATUS_EXPIRED)
-                {
-                    resolv_query(host);
-                    puts("Resolving host...");
-                    return HTTP_SOCKET_OK;
-                }
-                if (addr != NULL)
-                {
-                    s->did_tcp_connect = 1;
-                    tcp_socket_connect(&s->s, addr, port);
-                    return HTTP_SOCKET_OK;
-                }
-                else
-                {
-                    return HTTP_SOCKET_ERR;
-                }
+                return HTTP_SOCKET_ERR;
             }
         }
-        tcp_socket_connect(&s->s, &ip6addr, port);
-        return HTTP_SOCKET_OK;
-    }
-    else
-    {
-        return HTTP_SOCKET_ERR;
     }
+    /* Connected without a lookup, a later answer for the same host must not
+       restart or kill the request. */
+    s->did_tcp_connect = 1;
+    tcp_socket_connect(&s->s, &ip6addr, port);
+    return HTTP_SOCKET_OK;
 }
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(http_socket_process, ev, data)
@@ -689,13 +1077,11 @@ PROCESS_THREAD(http_socket_process, ev, data)
                  s != NULL;
                  s = list_item_next(s))
             {
-                char host[MAX_HOSTLEN];
                 if (s->did_tcp_connect)
                 {
                     /* We already connected, ignored */
                 }
-                else if (parse_url(s->url, host, NULL, NULL) &&
-                         strcmp(name, host) == 0)
+                else if (strcmp(name, s->buf->url) == 0)
                 {
                     if (resolv_lookup(name, NULL) == RESOLV_STATUS_CACHED)
                     {
@@ -715,6 +1101,8 @@ PROCESS_THREAD(http_socket_process, ev, data)
         {
             struct http_socket *s;
             struct etimer *timeout_timer = data;
+            http_socket_event_t e;
+            clock_time_t next;
             /*
        * A socket time-out has occurred. We need to go through the list of HTTP
        * sockets and figure out to which socket this timer event corresponds,
@@ -724,9 +1112,28 @@ PROCESS_THREAD(http_socket_process, ev, data)
                  s != NULL;
                  s = list_item_next(s))
             {
-                if (timeout_timer == &s->timeout_timer && s->timeout_timer_started)
+                if (timeout_timer == &s->timeout_timer)
                 {
-                    tcp_socket_close(&s->s);
+                    e = check_deadlines(s, &next);
+                    if (e == HTTP_SOCKET_TIMEDOUT)
+                    {
+                        /* Inactivity, the closed event is reported as
+               usual. */
+                        tcp_socket_close(&s->s);
+                    }
+                    else if (e != HTTP_SOCKET_OK)
+                    {
+                        /* A deadline of the request passed, free the
+               socket right away and report it, so the callback can
+               start a new request on it. */
+                        tcp_socket_close(&s->s);
+                        removesocket(s);
+                        call_callback(s, e, NULL, 0);
+                    }
+                    else
+                    {
+                        set_timeout_timer(s);
+                    }
                     break;
                 }
             }
@@ -744,31 +1151,107 @@ init(void)
     {
         process_start(&http_socket_process, NULL);
         list_init(socketlist);
+        memb_init(&buffers_mem);
         inited = 1;
     }
 }
 /*---------------------------------------------------------------------------*/
+static int
+is_running(struct http_socket *socket)
+{
+    struct http_socket *s;
+    for (s = list_head(socketlist);
+         s != NULL;
+         s = list_item_next(s))
+    {
+        if (s == socket)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
 void http_socket_init(struct http_socket *s)
 {
     init();
+    /* Only a running request holds buffers. */
+    if (!is_running(s))
+    {
+        s->buf = NULL;
+    }
     uip_create_unspecified(&s->proxy_addr);
     s->proxy_port = 0;
     s->custom_header[0] = 0;
+    s->header_set = NULL;
+    s->has_host_addr = 0;
+    s->connect_timeout = 0;
+    s->response_timeout = 0;
+    s->total_timeout = 0;
+    s->response_mode = HTTP_SOCKET_RESPONSE_BODY;
+    s->sink = NULL;
+    s->sinkptr = NULL;
 }
 /*---------------------------------------------------------------------------*/
-static void
-initialize_socket(struct http_socket *s)
+/* Borrows the buffers of the socket from the pool and parses the url of the
+   request into them. */
+static int
+initialize_socket(struct http_socket *s, const char *url)
 {
+    if (s->buf == NULL)
+    {
+        s->buf = memb_alloc(&buffers_mem);
+        if (s->buf == NULL)
+        {
+            printf("no free buffers\n");
+            return HTTP_SOCKET_ERR;
+        }
+    }
+    if (!parse_url(s, url))
+    {
+        memb_free(&buffers_mem, s->buf);
+        s->buf = NULL;
+        return HTTP_SOCKET_INVALID_URL;
+    }
+
     s->pos = 0;
     s->length = 0;
     s->postdata = NULL;
     s->postdatalen = 0;
+    s->producer = NULL;
+    s->body_length = 0;
+    s->body_sent = 0;
+    s->body_done = 0;
     s->timeout_timer_started = 0;
-    PT_INIT(&s->pt);
+    s->start_time = clock_time();
+    s->connected = 0;
+    s->request_sent = 0;
+    s->response_started = 0;
+    parse_header_init(s);
     tcp_socket_register(&s->s, s,
-                        s->inputbuf, sizeof(s->inputbuf),
-                        s->outputbuf, sizeof(s->outputbuf),
+                        s->buf->inputbuf, sizeof(s->buf->inputbuf),
+                        s->buf->outputbuf, sizeof(s->buf->outputbuf),
                         input, event);
+    return HTTP_SOCKET_OK;
+}
+/*---------------------------------------------------------------------------*/
+static int
+submit_request(struct http_socket *s)
+{
+    int ret;
+
+    list_add(socketlist, s);
+
+    ret = start_request(s);
+    if (ret == HTTP_SOCKET_ERR)
+    {
+        removesocket(s);
+    }
+    else
+    {
+        set_timeout_timer(s);
+    }
+    return ret;
 }
 /*---------------------------------------------------------------------------*/
 int http_socket_get(struct http_socket *s,
@@ -778,8 +1261,12 @@ int http_socket_get(struct http_socket *s,
                     http_socket_callback_t callback,
                     void *callbackptr)
 {
-    initialize_socket(s);
-    strncpy(s->url, url, sizeof(s->url));
+    int ret = initialize_socket(s, url);
+
+    if (ret != HTTP_SOCKET_OK)
+    {
+        return ret;
+    }
     s->method = HTTP_SOCKET_METHOD_GET;
     s->pos = pos;
     s->length = length;
@@ -788,9 +1275,7 @@ int http_socket_get(struct http_socket *s,
 
     s->did_tcp_connect = 0;
 
-    list_add(socketlist, s);
-
-    return start_request(s);
+    return submit_request(s);
 }
 /*---------------------------------------------------------------------------*/
 int http_socket_post(struct http_socket *s,
@@ -801,8 +1286,12 @@ int http_socket_post(struct http_socket *s,
                      http_socket_callback_t callback,
                      void *callbackptr)
 {
-    initialize_socket(s);
-    strncpy(s->url, url, sizeof(s->url));
+    int ret = initialize_socket(s, url);
+
+    if (ret != HTTP_SOCKET_OK)
+    {
+        return ret;
+    }
     s->method = HTTP_SOCKET_METHOD_POST;
     s->postdata = postdata;
     s->postdatalen = postdatalen;
@@ -813,9 +1302,7 @@ int http_socket_post(struct http_socket *s,
 
     s->did_tcp_connect = 0;
 
-    list_add(socketlist, s);
-
-    return start_request(s);
+    return submit_request(s);
 }
 /*---------------------------------------------------------------------------*/
 int http_socket_put(struct http_socket *s,
@@ -826,8 +1313,12 @@ int http_socket_put(struct http_socket *s,
                     http_socket_callback_t callback,
                     void *callbackptr)
 {
-    initialize_socket(s);
-    strncpy(s->url, url, sizeof(s->url));
+    int ret = initialize_socket(s, url);
+
+    if (ret != HTTP_SOCKET_OK)
+    {
+        return ret;
+    }
     s->method = HTTP_SOCKET_METHOD_PUT;
     s->postdata = postdata;
     s->postdatalen = postdatalen;
@@ -838,9 +1329,7 @@ int http_socket_put(struct http_socket *s,
 
     s->did_tcp_connect = 0;
 
-    list_add(socketlist, s);
-
-    return start_request(s);
+    return submit_request(s);
 }
 /*---------------------------------------------------------------------------*/
 int http_socket_delete(struct http_socket *s,
@@ -850,8 +1339,12 @@ int http_socket_delete(struct http_socket *s,
                        http_socket_callback_t callback,
                        void *callbackptr)
 {
-    initialize_socket(s);
-    strncpy(s->url, url, sizeof(s->url));
+    int ret = initialize_socket(s, url);
+
+    if (ret != HTTP_SOCKET_OK)
+    {
+        return ret;
+    }
     s->method = HTTP_SOCKET_METHOD_DELETE;
     s->pos = pos;
     s->length = length;
@@ -860,34 +1353,124 @@ int http_socket_delete(struct http_socket *s,
 
     s->did_tcp_connect = 0;
 
-    list_add(socketlist, s);
+    return submit_request(s);
+}
+/*---------------------------------------------------------------------------*/
+static int
+start_stream(struct http_socket *s,
+             const char *url,
+             http_socket_method_t method,
+             int32_t length,
+             const char *content_type,
+             http_socket_producer_t producer,
+             http_socket_callback_t callback,
+             void *callbackptr)
+{
+    int ret = initialize_socket(s, url);
+
+    if (ret != HTTP_SOCKET_OK)
+    {
+        return ret;
+    }
+    s->method = method;
+    s->producer = producer;
+    s->body_length = length;
+    s->content_type = content_type;
 
-    return start_request(s);
+    s->callback = callback;
+    s->callbackptr = callbackptr;
+
+    s->did_tcp_connect = 0;
+
+    return submit_request(s);
+}
+/*---------------------------------------------------------------------------*/
+int http_socket_post_stream(struct http_socket *s,
+                            const char *url,
+                            int32_t length,
+                            const char *content_type,
+                            http_socket_producer_t producer,
+                            http_socket_callback_t callback,
+                            void *callbackptr)
+{
+    return start_stream(s, url, HTTP_SOCKET_METHOD_POST, length, content_type,
+                        producer, callback, callbackptr);
+}
+/*---------------------------------------------------------------------------*/
+int http_socket_put_stream(struct http_socket *s,
+                           const char *url,
+                           int32_t length,
+                           const char *content_type,
+                           http_socket_producer_t producer,
+                           http_socket_callback_t callback,
+                           void *callbackptr)
+{
+    return start_stream(s, url, HTTP_SOCKET_METHOD_PUT, length, content_type,
+                        producer, callback, callbackptr);
 }
 /*---------------------------------------------------------------------------*/
 void http_socket_set_custom_header(struct http_socket *s,
     const char* header)
 {
-    strncpy(s->custom_header, header, sizeof(s->custom_header));
+    strncpy(s->custom_header, header, sizeof(s->custom_header) - 1);
+    s->custom_header[sizeof(s->custom_header) - 1] = 0;
 }
 /*---------------------------------------------------------------------------*/
-int http_socket_close(struct http_socket *socket)
+void http_socket_header_set_init(struct http_socket_header_set *set,
+                                 const char *const *headers, uint8_t count)
 {
-    struct http_socket *s;
-    for (s = list_head(socketlist);
-         s != NULL;
-         s = list_item_next(s))
+    set->headers = headers;
+    set->count = count;
+    set->len = 0;
+}
+/*---------------------------------------------------------------------------*/
+void http_socket_set_headers(struct http_socket *s,
+                             struct http_socket_header_set *set)
+{
+    s->header_set = set;
+}
+/*---------------------------------------------------------------------------*/
+int http_socket_close(struct http_socket *s)
+{
+    if (is_running(s))
     {
-        if (s == socket)
-        {
-            tcp_socket_close(&s->s);
-            removesocket(s);
-            return 1;
-        }
+        tcp_socket_close(&s->s);
+        removesocket(s);
+        return 1;
     }
     return 0;
 }
 /*---------------------------------------------------------------------------*/
+void http_socket_set_timeouts(struct http_socket *s,
+                              clock_time_t connect_timeout,
+                              clock_time_t response_timeout,
+                              clock_time_t total_timeout)
+{
+    s->connect_timeout = connect_timeout;
+    s->response_timeout = response_timeout;
+    s->total_timeout = total_timeout;
+}
+/*---------------------------------------------------------------------------*/
+void http_socket_set_response_mode(struct http_socket *s,
+                                   http_socket_response_mode_t mode)
+{
+    s->response_mode = mode;
+}
+/*---------------------------------------------------------------------------*/
+void http_socket_set_sink(struct http_socket *s,
+                          http_socket_sink_t sink, void *ptr)
+{
+    s->sink = sink;
+    s->sinkptr = ptr;
+}
+/*---------------------------------------------------------------------------*/
+void http_socket_set_host_address(struct http_socket *s,
+                                  const uip_ipaddr_t *addr)
+{
+    uip_ipaddr_copy(&s->host_addr, addr);
+    s->has_host_addr = 1;
+}
+/*---------------------------------------------------------------------------*/
 void http_socket_set_proxy(struct http_socket *s,
                            const uip_ipaddr_t *addr, uint16_t port)
 {
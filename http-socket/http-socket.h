@@ -45,6 +45,14 @@ typedef enum
     HTTP_SOCKET_TIMEDOUT,
     HTTP_SOCKET_ABORTED,
     HTTP_SOCKET_HOSTNAME_NOT_FOUND,
+    /* Deadlines set with http_socket_set_timeouts(). The socket is already
+       closed when they are reported. */
+    HTTP_SOCKET_CONNECT_TIMEDOUT,
+    HTTP_SOCKET_RESPONSE_TIMEDOUT,
+    HTTP_SOCKET_DEADLINE_EXCEEDED,
+    /* Returned instead of HTTP_SOCKET_ERR by the request functions when the
+       url can not be parsed, so retrying the request fails again. */
+    HTTP_SOCKET_INVALID_URL,
 } http_socket_event_t;
 
 typedef enum
@@ -73,15 +81,110 @@ typedef void (*http_socket_callback_t)(struct http_socket *s,
                                        const uint8_t *data,
                                        uint16_t datalen);
 
+/* Writes the next part of a streamed request body in buf, at most maxlen
+   bytes, and returns its length. Returning 0 ends the body. */
+typedef uint16_t (*http_socket_producer_t)(struct http_socket *s,
+                                           void *ptr,
+                                           uint8_t *buf,
+                                           uint16_t maxlen);
+
+/* Takes the next part of the response body, straight from the input buffer
+   of the socket. The data is only valid during the call. */
+typedef void (*http_socket_sink_t)(struct http_socket *s,
+                                   void *ptr,
+                                   const uint8_t *data,
+                                   uint16_t datalen);
+
+/* What is reported of a response. */
+typedef enum
+{
+    /* Status, headers and body (the default). */
+    HTTP_SOCKET_RESPONSE_BODY,
+    /* Status and headers, the body is read and discarded. */
+    HTTP_SOCKET_RESPONSE_HEADERS,
+    /* Only the status code, the connection is closed as soon as it is
+       known. */
+    HTTP_SOCKET_RESPONSE_STATUS,
+} http_socket_response_mode_t;
+
+/* Length of a streamed body that is not known in advance, it is sent with
+   chunked transfer encoding. */
+#define HTTP_SOCKET_LENGTH_UNKNOWN -1
+
 #define MAX(n, m) (((n) < (m)) ? (m) : (n))
+#ifndef MIN
+#define MIN(n, m) (((n) < (m)) ? (n) : (m))
+#endif
 
 #define HTTP_SOCKET_INPUTBUFSIZE UIP_TCP_MSS
 #define HTTP_SOCKET_OUTPUTBUFSIZE MAX(UIP_TCP_MSS, 256)
 
+/* Longest response line kept while parsing, longer header lines are cut. */
+#define HTTP_SOCKET_LINELEN 64
+
+typedef enum
+{
+    HTTP_SOCKET_PARSE_STATUS,
+    HTTP_SOCKET_PARSE_HEADERS,
+    HTTP_SOCKET_PARSE_BODY,
+    HTTP_SOCKET_PARSE_CHUNK_SIZE,
+    HTTP_SOCKET_PARSE_CHUNK_DATA,
+    HTTP_SOCKET_PARSE_CHUNK_END,
+    HTTP_SOCKET_PARSE_TRAILER,
+    HTTP_SOCKET_PARSE_DONE,
+} http_socket_parse_state_t;
+
 #define HTTP_SOCKET_URLLEN 128
 #define HTTP_SOCKET_CUSTOM_HEADER_LEN 80
 
+/* Longest preamble cached by a header set: the request line without its
+   path, the Host header and the headers of the set. */
+#ifdef HTTP_SOCKET_CONF_PREAMBLE_LEN
+#define HTTP_SOCKET_PREAMBLE_LEN HTTP_SOCKET_CONF_PREAMBLE_LEN
+#else
+#define HTTP_SOCKET_PREAMBLE_LEN 160
+#endif
+
+/* Headers sent with every request of a socket. The preamble of the last
+   request is kept formatted, so the next ones with the same method and
+   origin are sent with a single copy. */
+struct http_socket_header_set
+{
+    /* Each header without its line end, they are not copied. */
+    const char *const *headers;
+    uint8_t count;
+    /* Cached preamble, len is 0 when there is none. */
+    http_socket_method_t method;
+    uint16_t port;
+    uint8_t proxied;
+    uint16_t host_offset;
+    uint16_t host_len;
+    uint16_t path_offset;
+    uint16_t len;
+    char preamble[HTTP_SOCKET_PREAMBLE_LEN];
+};
+
+/* Number of requests that can be running at once. Their buffers are taken
+   from a shared pool only while the request is running. */
+#ifdef HTTP_SOCKET_CONF_BUFFERS
+#define HTTP_SOCKET_BUFFERS HTTP_SOCKET_CONF_BUFFERS
+#else
+#define HTTP_SOCKET_BUFFERS 2
+#endif
+
+struct http_socket_buffers
+{
+    uint8_t inputbuf[HTTP_SOCKET_INPUTBUFSIZE];
+    uint8_t outputbuf[HTTP_SOCKET_OUTPUTBUFSIZE];
+    /* Host and path of the url, each one NUL terminated. */
+    char url[HTTP_SOCKET_URLLEN];
+};
+
+#ifdef HTTP_SOCKET_CONF_TIMEOUT
+#define HTTP_SOCKET_TIMEOUT HTTP_SOCKET_CONF_TIMEOUT
+#else
 #define HTTP_SOCKET_TIMEOUT ((2 * 60 + 30) * CLOCK_SECOND)
+#endif
 
 struct http_socket
 {
@@ -89,26 +192,48 @@ struct http_socket
     struct tcp_socket s;
     uip_ipaddr_t proxy_addr;
     uint16_t proxy_port;
+    uip_ipaddr_t host_addr;
+    uint8_t has_host_addr;
     int64_t pos;
     uint64_t length;
     http_socket_method_t method;
     const uint8_t *postdata;
     uint16_t postdatalen;
+    http_socket_producer_t producer;
+    int32_t body_length;
+    int32_t body_sent;
+    uint8_t body_done;
     http_socket_callback_t callback;
     void *callbackptr;
     int did_tcp_connect;
-    char url[HTTP_SOCKET_URLLEN];
+    struct http_socket_buffers *buf;
+    uint16_t path_offset;
+    uint16_t port;
+    /* Copied, it is small next to the pooled buffers. */
     char custom_header[HTTP_SOCKET_CUSTOM_HEADER_LEN];
-    uint8_t inputbuf[HTTP_SOCKET_INPUTBUFSIZE];
-    uint8_t outputbuf[HTTP_SOCKET_OUTPUTBUFSIZE];
+    struct http_socket_header_set *header_set;
+    http_socket_response_mode_t response_mode;
+    http_socket_sink_t sink;
+    void *sinkptr;
 
+    /* A single timer for the next of the deadlines below. */
     struct etimer timeout_timer;
     uint8_t timeout_timer_started;
-    struct pt pt, headerpt;
-    int header_chars;
-    char header_field[15];
+    clock_time_t connect_timeout;
+    clock_time_t response_timeout;
+    clock_time_t total_timeout;
+    clock_time_t start_time;
+    clock_time_t sent_time;
+    clock_time_t activity_time;
+    uint8_t connected;
+    uint8_t request_sent;
+    uint8_t response_started;
+    http_socket_parse_state_t parse_state;
+    char line[HTTP_SOCKET_LINELEN];
+    uint16_t line_len;
+    uint8_t chunked;
+    uint32_t chunk_remaining;
     struct http_socket_header header;
-    uint8_t header_received;
     uint64_t bodylen;
     const char *content_type;
 };
@@ -139,11 +264,62 @@ int http_socket_delete(struct http_socket *s, const char *url,
                        http_socket_callback_t callback,
                        void *callbackptr);
 
+int http_socket_post_stream(struct http_socket *s, const char *url,
+                            int32_t length,
+                            const char *content_type,
+                            http_socket_producer_t producer,
+                            http_socket_callback_t callback,
+                            void *callbackptr);
+
+int http_socket_put_stream(struct http_socket *s, const char *url,
+                           int32_t length,
+                           const char *content_type,
+                           http_socket_producer_t producer,
+                           http_socket_callback_t callback,
+                           void *callbackptr);
+
 void http_socket_set_custom_header(struct http_socket *socket,
     const char* header);
 
+/* Prepares a header set with count headers. It must be prepared again if the
+   headers change. */
+void http_socket_header_set_init(struct http_socket_header_set *set,
+                                 const char *const *headers, uint8_t count);
+
+/* Sends the headers of set, before the custom header, with every request
+   until http_socket_init() is called again. The set is not copied and its
+   cache is updated by the requests, so it must be kept until they finish. */
+void http_socket_set_headers(struct http_socket *s,
+                             struct http_socket_header_set *set);
+
 int http_socket_close(struct http_socket *socket);
 
+/* Limits the time to connect (including the DNS lookup), to get the first
+   byte of the response once the request has been sent and to complete the
+   whole request, 0 for no limit. They apply until http_socket_init() is
+   called again. */
+void http_socket_set_timeouts(struct http_socket *s,
+                              clock_time_t connect_timeout,
+                              clock_time_t response_timeout,
+                              clock_time_t total_timeout);
+
+/* Reports only part of the responses, see http_socket_response_mode_t. In
+   status mode the HTTP_SOCKET_HEADER event only has the status code. It
+   applies until http_socket_init() is called again. */
+void http_socket_set_response_mode(struct http_socket *s,
+                                   http_socket_response_mode_t mode);
+
+/* Hands the body of the responses to sink instead of reporting it with
+   HTTP_SOCKET_DATA events. It applies until http_socket_init() is called
+   again. */
+void http_socket_set_sink(struct http_socket *s,
+                          http_socket_sink_t sink, void *ptr);
+
+/* Connects to this address instead of resolving the host of the url. It
+   applies until http_socket_init() is called again. */
+void http_socket_set_host_address(struct http_socket *s,
+                                  const uip_ipaddr_t *addr);
+
 void http_socket_set_proxy(struct http_socket *s,
                            const uip_ipaddr_t *addr, uint16_t port);
 
@@ -43,6 +43,22 @@
 #include "http-socket.h"
 #include "jsonparse.h"
 #include "ip64.h"
+#include "mote-stats.h"
+#include "json-writer.h"
+#include "uplink-dns.h"
+#ifdef MQTT_BROKER_ADDR
+#include "uplink-mqtt.h"
+#endif
+#ifdef COAP_COLLECTOR_ADDR
+#include "uplink-coap.h"
+#endif
+#include "telegram-digest.h"
+#include "ingress-limit.h"
+#include "local-http.h"
+#include "sample-history.h"
+#include "latency-histogram.h"
+#include "runtime-params.h"
+#include "dev/serial-line.h"
 
 #define DEBUG DEBUG_PRINT
 #include "net/ip/uip-debug.h"
@@ -56,9 +72,40 @@
 // define the period for sending http requests.
 #define HTTP_REQUEST_TIME 1 * CLOCK_SECOND
 
-// 5 seconds of http requests timeout.
+// 5 seconds of http requests timeout, used until the round trip time of an
+// endpoint has been measured.
 #define HTTP_REQUESTS_TIMEOUT_TIME 5 * CLOCK_SECOND
 
+// bounds of the request timeout computed from the measured round trip time.
+#ifndef HTTP_REQUESTS_MIN_TIMEOUT_TIME
+#define HTTP_REQUESTS_MIN_TIMEOUT_TIME (CLOCK_SECOND / 2)
+#endif
+
+#ifndef HTTP_REQUESTS_MAX_TIMEOUT_TIME
+#define HTTP_REQUESTS_MAX_TIMEOUT_TIME (30 * CLOCK_SECOND)
+#endif
+
+// consecutive failures needed to open the circuit of an endpoint. While the
+// circuit is open no requests are sent to it, they are held in the queue.
+#ifndef HTTP_CIRCUIT_FAILURE_THRESHOLD
+#define HTTP_CIRCUIT_FAILURE_THRESHOLD 3
+#endif
+
+// time to wait before probing an endpoint whose circuit is open. It is doubled
+// after each failed probe, up to the maximum.
+#ifndef HTTP_CIRCUIT_PROBE_INTERVAL
+#define HTTP_CIRCUIT_PROBE_INTERVAL (10 * CLOCK_SECOND)
+#endif
+
+#ifndef HTTP_CIRCUIT_PROBE_MAX_INTERVAL
+#define HTTP_CIRCUIT_PROBE_MAX_INTERVAL (5 * 60 * CLOCK_SECOND)
+#endif
+
+// times a request is tried before dropping it.
+#ifndef HTTP_REQUEST_MAX_ATTEMPTS
+#define HTTP_REQUEST_MAX_ATTEMPTS 3
+#endif
+
 // define number of motes if was not defined previosly.
 #ifndef NUMBER_OF_MOTES
 #define NUMBER_OF_MOTES 1
@@ -79,319 +126,2240 @@
 #define MOTE_HIGH_TEMP_LIMIT 40
 #endif
 
-// max 6 request for each mote, 5 for sentilo and 1 for telegram.
-#define MAX_HTTP_REQUESTS 6*NUMBER_OF_MOTES
+// an alert is raised once when its limit is crossed, and cleared once when the
+// value goes back past the limit by more than its hysteresis.
+#ifndef MOTE_LOW_BATTERY_HYSTERESIS
+#define MOTE_LOW_BATTERY_HYSTERESIS 50
+#endif
+
+#ifndef MOTE_LOW_PDR_HYSTERESIS
+#define MOTE_LOW_PDR_HYSTERESIS 5
+#endif
+
+#ifndef MOTE_HIGH_TEMP_HYSTERESIS
+#define MOTE_HIGH_TEMP_HYSTERESIS 2
+#endif
+
+// when a value is more than 3.0 standard deviations (in tenths) away from the
+// mean of its sensor, 0 to disable it. The alert is cleared once the values
+// are within 1.0 standard deviations less (0.1 at least).
+#ifndef MOTE_ANOMALY_Z_LIMIT
+#define MOTE_ANOMALY_Z_LIMIT 0
+#endif
+
+#define MOTE_ANOMALY_Z_HYSTERESIS 10
+
+// telegram messages are merged in a digest for each chat, sent at most every
+// TELEGRAM_DIGEST_WINDOW.
+#define TELEGRAM_PRIVATE_CHAT 0
+#define TELEGRAM_PUBLIC_CHAT 1
+#define TELEGRAM_NUMBER_OF_CHATS 2
+
+#ifndef TELEGRAM_DIGEST_WINDOW
+#define TELEGRAM_DIGEST_WINDOW (60 * CLOCK_SECOND)
+#endif
+
+// rate limits of the messages to each chat and of the whole bot: a burst of
+// messages and then one each interval. Telegram allows about 20 messages per
+// minute to a group and 30 per second for a bot.
+#ifndef TELEGRAM_CHAT_BURST
+#define TELEGRAM_CHAT_BURST 3
+#endif
+
+#ifndef TELEGRAM_CHAT_INTERVAL
+#define TELEGRAM_CHAT_INTERVAL (3 * CLOCK_SECOND)
+#endif
+
+#ifndef TELEGRAM_BOT_BURST
+#define TELEGRAM_BOT_BURST 30
+#endif
+
+#ifndef TELEGRAM_BOT_INTERVAL
+#define TELEGRAM_BOT_INTERVAL (CLOCK_SECOND / 30)
+#endif
+
+// time an endpoint is paused after answering 429 (too many requests).
+#ifndef HTTP_RATE_LIMIT_PAUSE
+#define HTTP_RATE_LIMIT_PAUSE (30 * CLOCK_SECOND)
+#endif
+
+// a reading of a sensor is uploaded only when it differs from the last one
+// uploaded by at least its deadband (in the units it is received, 0 to upload
+// every reading), or when the last one is older than UPLOAD_MAX_AGE.
+#ifndef UPLOAD_DEADBAND_TEMP
+#define UPLOAD_DEADBAND_TEMP 2
+#endif
+
+#ifndef UPLOAD_DEADBAND_HUM
+#define UPLOAD_DEADBAND_HUM 10
+#endif
+
+#ifndef UPLOAD_DEADBAND_LIGHT
+#define UPLOAD_DEADBAND_LIGHT 2
+#endif
+
+#ifndef UPLOAD_DEADBAND_BATT
+#define UPLOAD_DEADBAND_BATT 20
+#endif
+
+#ifndef UPLOAD_MAX_AGE
+#define UPLOAD_MAX_AGE (15 * 60 * CLOCK_SECOND)
+#endif
+
+// with a window (e.g. 60, 300 or 900 seconds) the readings of the sensors are
+// not uploaded, their min, max, mean and count are uploaded once the window
+// closes instead. 0 uploads every reading.
+#ifndef AGGREGATE_WINDOW
+#define AGGREGATE_WINDOW 0
+#endif
+
+// size of the body of a request with the aggregates of a sensor.
+#define SENTILO_AGGREGATE_BODY_SIZE 320
+
+// rate limit of the packets of each mote, checked both by its address and by
+// its id: a burst of packets and then one each interval. A mote that sends
+// more is ignored during the cooldown.
+#ifndef INGRESS_BURST
+#define INGRESS_BURST 5
+#endif
+
+#ifndef INGRESS_INTERVAL
+#define INGRESS_INTERVAL (2 * CLOCK_SECOND)
+#endif
+
+#ifndef INGRESS_COOLDOWN
+#define INGRESS_COOLDOWN (30 * CLOCK_SECOND)
+#endif
+
+// the round-trip probes of the motes are echoed as they arrive, without
+// parsing them. They have their own rate limit instead of the one of their
+// mote, so probing does not drop its readings.
+#define PROBE_PREFIX "{\"typ\": \"probe\""
+
+// longer packets starting as a probe are not echoed.
+#define MAX_PROBE_LEN 64
+
+#ifndef PROBE_ECHO_BURST
+#define PROBE_ECHO_BURST 10
+#endif
+
+#ifndef PROBE_ECHO_INTERVAL
+#define PROBE_ECHO_INTERVAL (CLOCK_SECOND / 10)
+#endif
+
+// rate limit of each endpoint: a burst of requests and then one each interval.
+#ifndef HTTP_ENDPOINT_BURST
+#define HTTP_ENDPOINT_BURST 5
+#endif
+
+#ifndef HTTP_ENDPOINT_INTERVAL
+#define HTTP_ENDPOINT_INTERVAL (CLOCK_SECOND / 2)
+#endif
+
+// max requests of a single mote in the queue of an endpoint, so a chatty mote
+// cannot take the room of the others.
+#ifndef HTTP_DEVICE_QUEUE_QUOTA
+#define HTTP_DEVICE_QUEUE_QUOTA 5
+#endif
+
+// max 5 sentilo requests for each mote and sentilo endpoint, and a digest for
+// each telegram chat.
+#define MAX_SENTILO_REQUESTS 5*NUMBER_OF_MOTES
+#define MAX_TELEGRAM_REQUESTS TELEGRAM_NUMBER_OF_CHATS
+
+#ifdef SENTILO_SECONDARY_URL
+#define MAX_HTTP_REQUESTS (2*MAX_SENTILO_REQUESTS + MAX_TELEGRAM_REQUESTS)
+#else
+#define MAX_HTTP_REQUESTS (MAX_SENTILO_REQUESTS + MAX_TELEGRAM_REQUESTS)
+#endif
+
+// how the sentilo endpoints are used:
+// - SINGLE: only the primary one (SENTILO_URL).
+// - FAILOVER: the primary one, switching to the secondary one while the
+//   primary fails or its round trip time is over SENTILO_FAILOVER_SLOW_RTT.
+// - FANOUT: both of them, each one with its own queue.
+#define SENTILO_MODE_SINGLE 0
+#define SENTILO_MODE_FAILOVER 1
+#define SENTILO_MODE_FANOUT 2
+
+#ifndef SENTILO_MODE
+#define SENTILO_MODE SENTILO_MODE_SINGLE
+#endif
+
+#ifndef SENTILO_FAILOVER_SLOW_RTT
+#define SENTILO_FAILOVER_SLOW_RTT (2 * CLOCK_SECOND)
+#endif
+
+// MQTT broker, given by its IPv6 address, the readings and the alerts are
+// published to. Without it the readings are sent to sentilo through HTTP.
+#ifdef MQTT_BROKER_ADDR
+
+#ifndef MQTT_BROKER_PORT
+#define MQTT_BROKER_PORT 1883
+#endif
+
+#ifndef MQTT_CLIENT_ID
+#define MQTT_CLIENT_ID "orion-border-router"
+#endif
+
+#ifndef MQTT_USERNAME
+#define MQTT_USERNAME NULL
+#define MQTT_PASSWORD NULL
+#endif
+
+// readings are published to {MQTT_DATA_TOPIC}/mote_{id}_{sensor} and alerts
+// to {MQTT_ALERT_TOPIC}/mote_{id}.
+#ifndef MQTT_DATA_TOPIC
+#define MQTT_DATA_TOPIC "orion/data"
+#endif
+
+#ifndef MQTT_ALERT_TOPIC
+#define MQTT_ALERT_TOPIC "orion/alerts"
+#endif
+
+#ifndef MQTT_DATA_QOS
+#define MQTT_DATA_QOS 0
+#endif
+
+#ifndef MQTT_ALERT_QOS
+#define MQTT_ALERT_QOS 1
+#endif
+
+#endif
+
+// CoAP collector, given by its IPv6 address, the readings are pushed to in
+// batches instead of sending them to sentilo through HTTP.
+#ifdef COAP_COLLECTOR_ADDR
+
+#ifdef MQTT_BROKER_ADDR
+#error "Only one of MQTT_BROKER_ADDR and COAP_COLLECTOR_ADDR can be used."
+#endif
+
+#ifndef COAP_COLLECTOR_PORT
+#define COAP_COLLECTOR_PORT 5683
+#endif
+
+#ifndef COAP_COLLECTOR_PATH
+#define COAP_COLLECTOR_PATH "data/orion"
+#endif
+
+// confirmable (1) or non-confirmable (0) messages.
+#ifndef COAP_CONFIRMABLE
+#define COAP_CONFIRMABLE 1
+#endif
+
+#endif
+
+// the UDP connection.
+static struct uip_udp_conn* server_conn;
+// a json parser for parsing the content of the packets.
+static struct jsonparse_state js_p_state;
+
+// timer to manage times when sending http requests.
+static struct etimer http_requests_timer;
+
+#define MS_TO_CLOCK(ms) ((clock_time_t)(ms) * CLOCK_SECOND / 1000)
+#define CLOCK_TO_MS(t) ((int32_t)((t) * 1000 / CLOCK_SECOND))
+
+// values of the settings above that can be changed at runtime through the
+// serial line (see runtime-params). Times are in milliseconds.
+static int32_t sentilo_mode = SENTILO_MODE;
+static int32_t low_battery_limit = MOTE_LOW_BATTERY_LIMIT;
+static int32_t low_pdr_limit = MOTE_LOW_PDR_LIMIT;
+static int32_t high_temp_limit = MOTE_HIGH_TEMP_LIMIT;
+static int32_t anomaly_z_limit = MOTE_ANOMALY_Z_LIMIT;
+static int32_t http_request_period = CLOCK_TO_MS(HTTP_REQUEST_TIME);
+static int32_t http_min_timeout = CLOCK_TO_MS(HTTP_REQUESTS_MIN_TIMEOUT_TIME);
+static int32_t http_max_timeout = CLOCK_TO_MS(HTTP_REQUESTS_MAX_TIMEOUT_TIME);
+static int32_t http_max_attempts = HTTP_REQUEST_MAX_ATTEMPTS;
+static int32_t circuit_failure_threshold = HTTP_CIRCUIT_FAILURE_THRESHOLD;
+static int32_t circuit_probe_interval = CLOCK_TO_MS(HTTP_CIRCUIT_PROBE_INTERVAL);
+static int32_t circuit_probe_max_interval =
+    CLOCK_TO_MS(HTTP_CIRCUIT_PROBE_MAX_INTERVAL);
+static int32_t failover_slow_rtt = CLOCK_TO_MS(SENTILO_FAILOVER_SLOW_RTT);
+static int32_t telegram_digest_window = CLOCK_TO_MS(TELEGRAM_DIGEST_WINDOW);
+static int32_t http_endpoint_interval = CLOCK_TO_MS(HTTP_ENDPOINT_INTERVAL);
+static int32_t http_device_quota = HTTP_DEVICE_QUEUE_QUOTA;
+#ifdef MQTT_BROKER_ADDR
+static int32_t mqtt_data_qos = MQTT_DATA_QOS;
+static int32_t mqtt_alert_qos = MQTT_ALERT_QOS;
+#endif
+
+typedef enum {SENTILO, TELEGRAM} TARGET_TYPE;
+typedef enum {TEMP, HUM, LIGHT, BATT, PDR, OTHER} DATA_TYPE;
+
+// sensors with statistics, the first values of DATA_TYPE.
+#define NUMBER_OF_SENSORS 4
+
+#if SAMPLE_HISTORY_VALUES < NUMBER_OF_SENSORS
+#error "SAMPLE_HISTORY_VALUES must hold a value for each sensor"
+#endif
+// what a sentilo request uploads: a reading, the aggregates of the last
+// window of a sensor or the history of a mote during an outage.
+typedef enum {SENTILO_READING, SENTILO_AGGREGATE, SENTILO_BACKFILL}
+    SENTILO_REQUEST_KIND;
+typedef enum {CIRCUIT_CLOSED, CIRCUIT_OPEN, CIRCUIT_HALF_OPEN} CIRCUIT_STATE;
+typedef enum {HTTP_RESULT_SUCCESS, HTTP_RESULT_REJECTED, HTTP_RESULT_FAILED,
+    HTTP_RESULT_RATE_LIMITED} HTTP_RESULT;
+
+// the upstream endpoints.
+#define SENTILO_PRIMARY 0
+#define SENTILO_SECONDARY 1
+#define TELEGRAM_API 2
+#define NUMBER_OF_ENDPOINTS 3
+
+// struct for storing the content of an http request.
+struct http_request
+{
+    struct http_request* next;
+    // device of a sentilo request, chat of a telegram one.
+    int target_id;
+    // index of its device (or chat), the queues are shared between them in
+    // round-robin order.
+    int flow;
+    DATA_TYPE data_type;
+    // value of the sensor, in the units it is received.
+    int value;
+    // the history sent by a backfill is kept in the device info.
+    SENTILO_REQUEST_KIND kind;
+    union
+    {
+        // the aggregates of a window of the sensor, copied since the next
+        // window may close while the request is queued.
+        struct mote_window window;
+        // range of the samples of a backfill, in seconds since boot.
+        struct
+        {
+            uint32_t from;
+            uint32_t to;
+        } range;
+    };
+    // for the latency of a reading: its sequence number, its time in the mesh
+    // (LATENCY_UNKNOWN if the mote did not tell when it was sampled) and when
+    // it was received.
+    int seq;
+    uint32_t transit;
+    clock_time_t ingest_time;
+    // queued for the secondary sentilo endpoint alone, which is only done in
+    // fan-out mode: the primary one has its own copy.
+    char fanout_copy;
+    // pointer to a char array that can contain extra data.
+    const char* large_data;
+    // number of times this request has been sent.
+    int attempts;
+};
+
+// struct for storing an upstream endpoint, its queue and its health.
+struct endpoint
+{
+    const char* name;
+    // base url of the endpoint, NULL if it is not configured.
+    const char* url;
+    TARGET_TYPE target_type;
+    // headers sent with every request (the identity key, if any), their
+    // preamble is kept formatted between requests.
+    char header[HTTP_SOCKET_CUSTOM_HEADER_LEN];
+    const char* header_list[1];
+    struct http_socket_header_set headers;
+
+    // requests waiting to be sent to this endpoint.
+    LIST_STRUCT(request_list);
+    int max_requests;
+    // flow to be served first by the next request taken from the queue.
+    int next_flow;
+    // limits the rate of the requests sent, not of the probes.
+    struct token_bucket bucket;
+
+    // each endpoint has its own socket, so a slow one does not hold back the
+    // others.
+    struct http_socket socket;
+    // the request being sent (NULL when probing), kept until its result is
+    // known.
+    struct http_request* current_request;
+    char sending;
+    char response_received;
+
+    // paused after being told to slow down.
+    struct timer rate_limit_timer;
+
+    CIRCUIT_STATE circuit_state;
+    int consecutive_failures;
+    clock_time_t probe_interval;
+    struct timer probe_timer;
+    // smoothed round trip time (scaled by 8) and its mean deviation (scaled
+    // by 4), estimated as TCP does for its retransmission timeout.
+    long srtt;
+    long rttvar;
+    clock_time_t timeout;
+    clock_time_t request_start;
+
+    // handle of its host in the dns cache, -1 if it is an address.
+    int dns_host;
+
+    // seconds since boot of the first of the current consecutive failures.
+    uint32_t failing_since;
+};
+
+// list of endpoints.
+static struct endpoint endpoint_list[NUMBER_OF_ENDPOINTS];
+
+// last value of a sensor that was uploaded.
+struct last_upload
+{
+    int value;
+    char valid;
+    clock_time_t time;
+};
+
+// latency of the readings of a mote in each stage: from its sampling to its
+// reception (mesh), waiting in the queue of a sentilo endpoint until its last
+// attempt (queue), the http request until the 2xx response (http) and all of
+// them (total).
+struct latency_stats
+{
+    struct latency_histogram mesh;
+    struct latency_histogram queue[SENTILO_SECONDARY + 1];
+    struct latency_histogram http[SENTILO_SECONDARY + 1];
+    struct latency_histogram total[SENTILO_SECONDARY + 1];
+};
+
+#define LATENCY_UNKNOWN UINT32_MAX
+
+// struct for storing device info/data.
+struct device_info {
+    int device_id;
+    char f_update_sensors_data_on_telegram;
+    int packets_received;
+    int packets_sent;
+    // when its last data packet was received, if any.
+    char seen;
+    clock_time_t last_seen;
+    // running statistics of each sensor and alerts.
+    struct mote_stats stats[NUMBER_OF_SENSORS];
+    struct mote_alert anomaly_alert[NUMBER_OF_SENSORS];
+    struct mote_alert high_temp_alert;
+    struct mote_alert low_battery_alert;
+    struct mote_alert low_pdr_alert;
+    struct mote_alert sensor_error_alert;
+    // rate limit of the packets with its id.
+    struct ingress_limit ingress;
+    // readings uploaded, for not uploading the unchanged ones again.
+    struct last_upload last_upload[NUMBER_OF_SENSORS];
+    // aggregates of the current window and of the last closed one, which is
+    // copied into the requests that upload it.
+    struct mote_window window[NUMBER_OF_SENSORS];
+    struct mote_window closed_window[NUMBER_OF_SENSORS];
+    // recent samples of its sensors.
+    struct sample_history history;
+    // the clock of the mote (ms) minus the one of the router for its fastest
+    // recent packet, and the sample time and time in the mesh of its last one.
+    uint32_t clock_offset;
+    char clock_offset_valid;
+    uint32_t last_ts;
+    uint32_t last_transit;
+    struct latency_stats latency;
+};
+
+// declare a list of device info, one for each mote.
+struct device_info device_info_list[NUMBER_OF_MOTES];
+
+// deadband of each sensor and max age of the readings uploaded, in the units
+// they are received and in ms.
+static int32_t upload_deadband[NUMBER_OF_SENSORS] = {UPLOAD_DEADBAND_TEMP,
+    UPLOAD_DEADBAND_HUM, UPLOAD_DEADBAND_LIGHT, UPLOAD_DEADBAND_BATT};
+static int32_t upload_max_age = CLOCK_TO_MS(UPLOAD_MAX_AGE);
+static int32_t aggregate_window = CLOCK_TO_MS(AGGREGATE_WINDOW);
+static struct timer aggregate_timer;
+
+// seconds since the epoch at boot, 0 while unknown. It is set through the
+// serial line, and needed for the timestamps of the backfills.
+static uint32_t wall_clock_offset;
+
+// bodies of the aggregate requests of the sentilo endpoints.
+static char sentilo_body[SENTILO_SECONDARY + 1][SENTILO_AGGREGATE_BODY_SIZE];
+
+// packets dropped by the ingress rate limits.
+static unsigned long ingress_dropped;
+
+// rate limit of the probe echoes, and the probes echoed and dropped.
+static struct token_bucket probe_echo_bucket;
+static unsigned long probes_echoed;
+static unsigned long probes_dropped;
+
+// digests of the telegram messages and rate limit of the bot.
+static struct telegram_digest telegram_digests[TELEGRAM_NUMBER_OF_CHATS];
+static struct token_bucket telegram_bot_bucket;
+
+// declare a pool of http requests, shared by the endpoint queues.
+MEMB(http_request_mem, struct http_request, MAX_HTTP_REQUESTS);
+
+PROCESS(border_router_and_udp_server_process, "Border Router and UDP server process");
+AUTOSTART_PROCESSES(&border_router_and_udp_server_process);
+
+// function that returns the info struct of a specific device.
+static struct device_info* get_device_info(int target_device_id)
+{
+    struct device_info* info = NULL;
+
+    for (int i = 0; i < NUMBER_OF_MOTES; i++)
+    {
+        if (device_info_list[i].device_id == target_device_id)
+        {
+            info = &device_info_list[i];
+
+            break;
+        }
+    }
+
+    return info;
+}
+
+static void get_data_type_as_string(DATA_TYPE dt, char* out)
+{
+    switch (dt)
+    {
+        case TEMP:
+            sprintf(out, "temp");
+            break;
+
+        case HUM:
+            sprintf(out, "hum");
+            break;
+
+        case LIGHT:
+            sprintf(out, "light");
+            break;
+
+        case BATT:
+            sprintf(out, "batt");
+            break;
+
+        case PDR:
+            sprintf(out, "pdr");
+            break;
+
+        case OTHER:
+            // do nothing.
+            break;
+
+        default:
+            // do nothing.
+            break;
+    }
+}
+
+// writes a value of a sensor, received in tenths of degree or percent for
+// temperature and humidity, mV for battery and percent for light and pdr, in
+// degrees, percent and V.
+static void write_sensor_value(struct json_writer* w, DATA_TYPE dt, int value)
+{
+    switch (dt)
+    {
+        case TEMP:
+        case HUM:
+            json_writer_fixed(w, value, 1);
+            break;
+
+        case BATT:
+            json_writer_fixed(w, value / 10, 2);
+            break;
+
+        default:
+            json_writer_int(w, value);
+            break;
+    }
+}
+
+// updates the statistics of a sensor of a device and returns the change of
+// its anomaly alert, if any. The value is checked before being added, so an
+// outlier does not hide itself.
+static mote_alert_event_t update_sensor_stats(struct device_info* info,
+    DATA_TYPE dt, int value)
+{
+    struct mote_stats* st = &info->stats[dt];
+    mote_alert_event_t event;
+    char data_type_string[8];
+    // below the hysteresis the limit to clear it would be 0 or less, which
+    // would not take anything as an outlier and clear it at once.
+    int32_t clear_limit = anomaly_z_limit > MOTE_ANOMALY_Z_HYSTERESIS ?
+        anomaly_z_limit - MOTE_ANOMALY_Z_HYSTERESIS : 1;
+
+    event = mote_alert_update(&info->anomaly_alert[dt],
+        mote_stats_is_outlier(st, value, anomaly_z_limit),
+        !mote_stats_is_outlier(st, value, clear_limit));
+
+    mote_stats_update(st, value);
+
+    get_data_type_as_string(dt, data_type_string);
+    PRINTF("%s stats: ewma %ld, mean %ld, min %ld, max %ld\n",
+        data_type_string, (long)mote_stats_ewma(st), (long)mote_stats_mean(st),
+        (long)st->min, (long)st->max);
+
+    return event;
+}
+
+static const char* get_sentilo_mode_as_string(int mode)
+{
+    switch (mode)
+    {
+        case SENTILO_MODE_FAILOVER:
+            return "failover";
+
+        case SENTILO_MODE_FANOUT:
+            return "fan-out";
+
+        default:
+            return "single";
+    }
+}
+
+// in failover mode, returns the sentilo endpoint that has to send the
+// requests: the primary one unless it fails or it is slower than the limit
+// and than the secondary one. The one that is not preferred is probed to keep
+// its rtt up to date, and the secondary one is not taken before it is
+// measured.
+static struct endpoint* get_preferred_sentilo_endpoint()
+{
+    struct endpoint* primary = &endpoint_list[SENTILO_PRIMARY];
+    struct endpoint* secondary = &endpoint_list[SENTILO_SECONDARY];
+
+    if (secondary->url == NULL || secondary->circuit_state != CIRCUIT_CLOSED)
+    {
+        return primary;
+    }
+
+    if (primary->circuit_state != CIRCUIT_CLOSED)
+    {
+        return secondary;
+    }
+
+    if ((primary->srtt >> 3) > MS_TO_CLOCK(failover_slow_rtt) &&
+        secondary->srtt > 0 && secondary->srtt < primary->srtt)
+    {
+        return secondary;
+    }
+
+    return primary;
+}
+
+// returns the endpoint whose queue an endpoint takes its requests from. In
+// failover mode all sentilo requests are queued in the primary endpoint,
+// whichever sends them.
+static struct endpoint* get_queue_owner(struct endpoint* e)
+{
+    if (sentilo_mode == SENTILO_MODE_FAILOVER && e->target_type == SENTILO)
+    {
+        return &endpoint_list[SENTILO_PRIMARY];
+    }
+
+    return e;
+}
+
+static list_t get_endpoint_queue(struct endpoint* e)
+{
+    return get_queue_owner(e)->request_list;
+}
+
+// returns the endpoint whose queue a request sent by an endpoint belongs to.
+// Only the fan-out copies are owned by the secondary sentilo endpoint, any
+// other request it sends was taken from the primary one in failover mode,
+// even if the mode changed since.
+static struct endpoint* get_request_owner(struct endpoint* e,
+    struct http_request* r)
+{
+    if (e == &endpoint_list[SENTILO_SECONDARY] && !r->fanout_copy)
+    {
+        return &endpoint_list[SENTILO_PRIMARY];
+    }
+
+    return get_queue_owner(e);
+}
+
+// number of requests of the queue of an endpoint, counting the ones being sent.
+static int count_endpoint_requests(struct endpoint* e)
+{
+    int count = list_length(e->request_list);
+
+    for (int i = 0; i < NUMBER_OF_ENDPOINTS; i++)
+    {
+        struct endpoint* sender = &endpoint_list[i];
+
+        if (sender->current_request != NULL &&
+            get_request_owner(sender, sender->current_request) == e)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+// number of requests of a flow waiting in the queue of an endpoint.
+static int count_flow_requests(struct endpoint* e, int flow)
+{
+    struct http_request* r;
+    int count = 0;
+
+    for (r = list_head(e->request_list); r != NULL; r = r->next)
+    {
+        if (r->flow == flow)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+// returns 1 if a device can queue one more reading or aggregate in an
+// endpoint, so a chatty mote cannot take the requests of the others.
+static int has_device_quota(struct endpoint* e, int flow)
+{
+    if (count_flow_requests(e, flow) >= http_device_quota)
+    {
+        PRINTF("Device quota in %s is full, dropping request.\n", e->name);
+        return 0;
+    }
+
+    return 1;
+}
+
+// allocates a request of a flow for an endpoint if its queue is not full, so
+// a failing endpoint cannot take the requests of the others.
+static struct http_request* new_http_request(struct endpoint* e, int flow)
+{
+    struct http_request* r = NULL;
+
+    if (count_endpoint_requests(e) >= e->max_requests)
+    {
+        PRINTF("Queue of %s is full, dropping request.\n", e->name);
+    }
+    else
+    {
+        r = (struct http_request*) memb_alloc(&http_request_mem);
+
+        if (r == NULL)
+        {
+            PRINTF("No free requests, dropping request to %s.\n", e->name);
+        }
+    }
+
+    if (r != NULL)
+    {
+        r->flow = flow;
+        r->kind = SENTILO_READING;
+        r->transit = LATENCY_UNKNOWN;
+        r->fanout_copy =
+            get_queue_owner(e) == &endpoint_list[SENTILO_SECONDARY];
+        r->attempts = 0;
+    }
+
+    return r;
+}
+
+// frees a request that is not going to be sent again.
+static void free_http_request(struct endpoint* e, struct http_request* r)
+{
+    // the body of a telegram request is a digest, it can be reused now.
+    if (e->target_type == TELEGRAM && r->large_data != NULL)
+    {
+        telegram_digest_sent(&telegram_digests[r->target_id]);
+    }
+
+    memb_free(&http_request_mem, r);
+}
+
+// queues the telegram digests that are due, within the rate limits of their
+// chats and of the bot.
+static void queue_telegram_digests()
+{
+    for (int i = 0; i < TELEGRAM_NUMBER_OF_CHATS; i++)
+    {
+        struct telegram_digest* d = &telegram_digests[i];
+        struct http_request* r;
+
+        if (!telegram_digest_ready(d, &telegram_bot_bucket))
+        {
+            continue;
+        }
+
+        r = new_http_request(&endpoint_list[TELEGRAM_API], i);
+
+        if (r != NULL)
+        {
+            r->target_id = i;
+            r->data_type = OTHER;
+            r->large_data = telegram_digest_take(d, &telegram_bot_bucket);
+
+            list_push(endpoint_list[TELEGRAM_API].request_list, r);
+        }
+    }
+}
+
+static void queue_sentilo_request_to(struct endpoint* e, int device_id,
+    DATA_TYPE data_type, int value, SENTILO_REQUEST_KIND kind)
+{
+    struct device_info* info = get_device_info(device_id);
+    struct http_request* r;
+
+    if (info == NULL)
+    {
+        return;
+    }
+
+    if (!has_device_quota(e, info - device_info_list))
+    {
+        return;
+    }
+
+    r = new_http_request(e, info - device_info_list);
+
+    if (r != NULL)
+    {
+        r->target_id = device_id;
+        r->data_type = data_type;
+        r->value = value;
+        r->kind = kind;
+
+        if (kind == SENTILO_AGGREGATE)
+        {
+            r->window = info->closed_window[data_type];
+        }
+
+        // a reading is queued as soon as its packet is received.
+        r->seq = info->packets_sent;
+        r->transit = info->last_transit;
+        r->ingest_time = info->last_seen;
+
+        list_push(e->request_list, r);
+    }
+}
+
+// writes the name of a sensor of a device, mote_{id}_{sensor}{suffix}.
+static void write_sensor_name(struct json_writer* w, int device_id,
+    DATA_TYPE data_type, const char* suffix)
+{
+    char data_type_string[8];
+
+    get_data_type_as_string(data_type, data_type_string);
+
+    json_writer_raw(w, "mote_");
+    json_writer_int(w, device_id);
+    json_writer_raw(w, "_");
+    json_writer_raw(w, data_type_string);
+    json_writer_raw(w, suffix);
+}
+
+// writes the aggregates of a window of a sensor as sentilo observations of the
+// sensors mote_{id}_{sensor}_min, _max, _mean and _count.
+static void write_sentilo_aggregates(struct json_writer* w, int device_id,
+    DATA_TYPE data_type, const struct mote_window* window)
+{
+    static const char* const suffixes[] = {"_min", "_max", "_mean", "_count"};
+    int32_t values[] = {window->min, window->max, mote_window_mean(window),
+        window->count};
+
+    // {"sensors":[{"sensor":"mote_1_temp_min","observations":[{"value":"21.5"}]},...]}
+    json_writer_object_start(w);
+    json_writer_key(w, "sensors");
+    json_writer_array_start(w);
+
+    for (int i = 0; i < 4; i++)
+    {
+        json_writer_object_start(w);
+        json_writer_key(w, "sensor");
+        json_writer_string_start(w);
+        write_sensor_name(w, device_id, data_type, suffixes[i]);
+        json_writer_string_end(w);
+        json_writer_key(w, "observations");
+        json_writer_array_start(w);
+        json_writer_object_start(w);
+        json_writer_key(w, "value");
+        json_writer_string_start(w);
+
+        if (i == 3)
+        {
+            json_writer_int(w, values[i]);
+        }
+        else
+        {
+            write_sensor_value(w, data_type, values[i]);
+        }
+
+        json_writer_string_end(w);
+        json_writer_object_end(w);
+        json_writer_array_end(w);
+        json_writer_object_end(w);
+    }
+
+    json_writer_array_end(w);
+    json_writer_object_end(w);
+}
+
+#ifdef MQTT_BROKER_ADDR
+// publishes a reading of a sensor of a device, returns 0 if it is dropped.
+static int publish_mqtt_reading(int device_id, DATA_TYPE data_type, int value)
+{
+    char topic[UPLINK_MQTT_TOPIC_LEN];
+    char payload[16];
+    char data_type_string[8];
+    struct json_writer w;
+
+    get_data_type_as_string(data_type, data_type_string);
+
+    // {MQTT_DATA_TOPIC}/mote_{id}_{sensor}
+    json_writer_init(&w, topic, sizeof(topic));
+    json_writer_raw(&w, MQTT_DATA_TOPIC "/mote_");
+    json_writer_int(&w, device_id);
+    json_writer_raw(&w, "_");
+    json_writer_raw(&w, data_type_string);
+
+    json_writer_init(&w, payload, sizeof(payload));
+    write_sensor_value(&w, data_type, value);
+
+    return uplink_mqtt_publish(topic, payload, mqtt_data_qos);
+}
+
+// publishes an alert of a device if it was raised or cleared, with the sensor
+// and the value that changed it (none for OTHER).
+static void publish_mqtt_alert(int device_id, const char* alert,
+    mote_alert_event_t event, DATA_TYPE data_type, int value)
+{
+    char topic[UPLINK_MQTT_TOPIC_LEN];
+    char payload[UPLINK_MQTT_PAYLOAD_LEN];
+    char data_type_string[8];
+    struct json_writer w;
+
+    if (event == MOTE_ALERT_NONE)
+    {
+        return;
+    }
+
+    // {MQTT_ALERT_TOPIC}/mote_{id}
+    json_writer_init(&w, topic, sizeof(topic));
+    json_writer_raw(&w, MQTT_ALERT_TOPIC "/mote_");
+    json_writer_int(&w, device_id);
+
+    // {"alert":"{alert}","state":"raised","sensor":"temp","value":23.5}
+    json_writer_init(&w, payload, sizeof(payload));
+    json_writer_object_start(&w);
+    json_writer_key(&w, "alert");
+    json_writer_string(&w, alert);
+    json_writer_key(&w, "state");
+    json_writer_string(&w,
+        event == MOTE_ALERT_RAISED ? "raised" : "cleared");
+
+    if (data_type != OTHER)
+    {
+        get_data_type_as_string(data_type, data_type_string);
+        json_writer_key(&w, "sensor");
+        json_writer_string(&w, data_type_string);
+        json_writer_key(&w, "value");
+        write_sensor_value(&w, data_type, value);
+    }
+
+    json_writer_object_end(&w);
+
+    uplink_mqtt_publish(topic, payload, mqtt_alert_qos);
+}
+#endif
+
+#ifdef COAP_COLLECTOR_ADDR
+// adds a reading of a sensor of a device to the batch for the collector,
+// returns 0 if it is dropped.
+static int push_coap_reading(int device_id, DATA_TYPE data_type, int value)
+{
+    char sensor[24];
+    char payload[16];
+    char data_type_string[8];
+    struct json_writer w;
+
+    get_data_type_as_string(data_type, data_type_string);
+
+    // mote_{id}_{sensor}
+    json_writer_init(&w, sensor, sizeof(sensor));
+    json_writer_raw(&w, "mote_");
+    json_writer_int(&w, device_id);
+    json_writer_raw(&w, "_");
+    json_writer_raw(&w, data_type_string);
+
+    json_writer_init(&w, payload, sizeof(payload));
+    write_sensor_value(&w, data_type, value);
+
+    return uplink_coap_add(sensor, payload);
+}
+#endif
+
+// returns 1 if a reading of a sensor has to be uploaded, that is when it
+// differs from the last one uploaded by at least the deadband of its sensor or
+// the last one is too old.
+static int must_upload(int device_id, DATA_TYPE data_type, int value)
+{
+    struct device_info* info = get_device_info(device_id);
+    struct last_upload* last;
+
+    // only the sensors are filtered, the pdr is sent once each cycle.
+    if (info == NULL || data_type >= NUMBER_OF_SENSORS)
+    {
+        return 1;
+    }
+
+    last = &info->last_upload[data_type];
+
+    return !last->valid ||
+        abs(value - last->value) >= upload_deadband[data_type] ||
+        clock_time() - last->time >= MS_TO_CLOCK(upload_max_age);
+}
+
+// keeps a reading of a sensor as the last one uploaded, once it is delivered,
+// so a reading that is lost does not hold back the next ones.
+static void update_last_upload(int device_id, DATA_TYPE data_type, int value)
+{
+    struct device_info* info = get_device_info(device_id);
+    struct last_upload* last;
+
+    if (info == NULL || data_type >= NUMBER_OF_SENSORS)
+    {
+        return;
+    }
+
+    last = &info->last_upload[data_type];
+    last->value = value;
+    last->valid = 1;
+    last->time = clock_time();
+}
+
+// adds a request to update a sensor of a device on sentilo, or publishes it if
+// a MQTT broker or a CoAP collector is used. Readings that did not change are
+// skipped.
+static void queue_sentilo_request(int device_id, DATA_TYPE data_type,
+    int value)
+{
+    struct device_info* info = get_device_info(device_id);
+
+    // while aggregating, the readings of the sensors are only added to the
+    // window.
+    if (aggregate_window > 0 && data_type < NUMBER_OF_SENSORS)
+    {
+        if (info != NULL)
+        {
+            mote_window_update(&info->window[data_type], value);
+        }
+
+        return;
+    }
+
+    if (!must_upload(device_id, data_type, value))
+    {
+        return;
+    }
+
+#if defined(MQTT_BROKER_ADDR)
+    if (publish_mqtt_reading(device_id, data_type, value))
+    {
+        update_last_upload(device_id, data_type, value);
+    }
+#elif defined(COAP_COLLECTOR_ADDR)
+    if (push_coap_reading(device_id, data_type, value))
+    {
+        update_last_upload(device_id, data_type, value);
+    }
+#else
+    // through HTTP it is kept as the last one once sentilo acknowledges it.
+    queue_sentilo_request_to(&endpoint_list[SENTILO_PRIMARY], device_id,
+        data_type, value, SENTILO_READING);
+
+    if (sentilo_mode == SENTILO_MODE_FANOUT &&
+        endpoint_list[SENTILO_SECONDARY].url != NULL)
+    {
+        queue_sentilo_request_to(&endpoint_list[SENTILO_SECONDARY], device_id,
+            data_type, value, SENTILO_READING);
+    }
+#endif
+}
+
+// uploads the aggregates of the last window of a sensor of a device, kept in
+// its closed window.
+static void queue_sentilo_aggregate(struct device_info* info,
+    DATA_TYPE data_type)
+{
+    const struct mote_window* window = &info->closed_window[data_type];
+
+#if defined(MQTT_BROKER_ADDR)
+    char topic[UPLINK_MQTT_TOPIC_LEN];
+    char payload[UPLINK_MQTT_PAYLOAD_LEN];
+    struct json_writer w;
+
+    // {MQTT_DATA_TOPIC}/mote_{id}_{sensor}_window
+    json_writer_init(&w, topic, sizeof(topic));
+    json_writer_raw(&w, MQTT_DATA_TOPIC "/");
+    write_sensor_name(&w, info->device_id, data_type, "_window");
+
+    // {"min":21.5,"max":23.0,"mean":22.1,"count":15}
+    json_writer_init(&w, payload, sizeof(payload));
+    json_writer_object_start(&w);
+    json_writer_key(&w, "min");
+    write_sensor_value(&w, data_type, window->min);
+    json_writer_key(&w, "max");
+    write_sensor_value(&w, data_type, window->max);
+    json_writer_key(&w, "mean");
+    write_sensor_value(&w, data_type, mote_window_mean(window));
+    json_writer_key(&w, "count");
+    json_writer_int(&w, window->count);
+    json_writer_object_end(&w);
+
+    uplink_mqtt_publish(topic, payload, mqtt_data_qos);
+#elif defined(COAP_COLLECTOR_ADDR)
+    static const char* const suffixes[] = {"_min", "_max", "_mean", "_count"};
+    int32_t values[] = {window->min, window->max, mote_window_mean(window),
+        window->count};
+    char sensor[32];
+    char payload[16];
+    struct json_writer w;
+
+    for (int i = 0; i < 4; i++)
+    {
+        json_writer_init(&w, sensor, sizeof(sensor));
+        write_sensor_name(&w, info->device_id, data_type, suffixes[i]);
+
+        json_writer_init(&w, payload, sizeof(payload));
+        if (i == 3)
+        {
+            json_writer_int(&w, values[i]);
+        }
+        else
+        {
+            write_sensor_value(&w, data_type, values[i]);
+        }
+
+        uplink_coap_add(sensor, payload);
+    }
+#else
+    queue_sentilo_request_to(&endpoint_list[SENTILO_PRIMARY], info->device_id,
+        data_type, 0, SENTILO_AGGREGATE);
+
+    if (sentilo_mode == SENTILO_MODE_FANOUT &&
+        endpoint_list[SENTILO_SECONDARY].url != NULL)
+    {
+        queue_sentilo_request_to(&endpoint_list[SENTILO_SECONDARY],
+            info->device_id, data_type, 0, SENTILO_AGGREGATE);
+    }
+#endif
+}
+
+// returns the sensors (one bit each) with samples in the history of a device
+// from one time to another, in seconds since boot, and the time of the first
+// of them if first is not NULL.
+static uint8_t get_history_sensors(const struct device_info* info,
+    uint32_t from, uint32_t to, uint32_t* first)
+{
+    struct sample_history_cursor c;
+    struct sample_history_sample sample;
+    uint8_t sensors = 0;
+
+    sample_history_cursor_init(&c, &info->history);
+
+    while (sample_history_next(&c, &sample))
+    {
+        if (sample.time >= from && sample.time < to)
+        {
+            if (sensors == 0 && first != NULL)
+            {
+                *first = sample.time;
+            }
+
+            sensors |= sample.mask;
+        }
+    }
+
+    return sensors;
+}
+
+// drops the readings of a device held in the queue of an endpoint that were
+// received from one time to another, in seconds since boot. A backfill
+// uploads them with their timestamps, sending them as well would store them
+// twice, the second time at the time of the upload.
+static void drop_backfilled_readings(struct endpoint* e, int flow,
+    uint32_t from, uint32_t to)
+{
+    list_t queue = get_endpoint_queue(e);
+    struct http_request* r = list_head(queue);
+    struct http_request* next;
+
+    for (; r != NULL; r = next)
+    {
+        uint32_t received = r->ingest_time / CLOCK_SECOND;
+
+        next = r->next;
+
+        if (r->flow == flow && r->kind == SENTILO_READING &&
+            received >= from && received < to)
+        {
+            list_remove(queue, r);
+            free_http_request(e, r);
+        }
+    }
+}
+
+// queues the upload of the history of each mote during the outage of a
+// sentilo endpoint, which has just ended. The samples are sent with their
+// timestamps, so they need the wall clock.
+static void queue_sentilo_backfill(struct endpoint* e, uint32_t from,
+    uint32_t to)
+{
+    // in failover mode the readings are held in a queue shared by both
+    // endpoints and sent by the first one that works, so nothing is missing
+    // and there is nothing to backfill.
+    if (e->target_type != SENTILO || sentilo_mode == SENTILO_MODE_FAILOVER)
+    {
+        return;
+    }
+
+    if (wall_clock_offset == 0)
+    {
+        PRINTF("Wall clock not set, %s will not be backfilled.\n", e->name);
+        return;
+    }
+
+    for (int i = 0; i < NUMBER_OF_MOTES; i++)
+    {
+        struct device_info* info = &device_info_list[i];
+        struct http_request* r;
+        uint32_t first;
+
+        if (get_history_sensors(info, from, to, &first) == 0)
+        {
+            continue;
+        }
+
+        // the samples older than the history are still sent as they are. The
+        // backfill is not limited by the quota of the device, which the held
+        // readings fill during any outage.
+        drop_backfilled_readings(e, i, first, to);
+
+        r = new_http_request(e, i);
+
+        if (r != NULL)
+        {
+            r->target_id = info->device_id;
+            r->data_type = OTHER;
+            r->kind = SENTILO_BACKFILL;
+            r->range.from = from;
+            r->range.to = to;
+
+            list_push(e->request_list, r);
+        }
+    }
+
+    PRINTF("Backfilling %s with the last %lu seconds.\n", e->name,
+        (unsigned long)(to - from));
+}
+
+// closes the aggregation window when it is due, uploading the aggregates of
+// each sensor that got readings during it.
+static void close_aggregate_windows()
+{
+    if (aggregate_window <= 0 || !timer_expired(&aggregate_timer))
+    {
+        return;
+    }
+
+    timer_set(&aggregate_timer, MS_TO_CLOCK(aggregate_window));
+
+    for (int i = 0; i < NUMBER_OF_MOTES; i++)
+    {
+        struct device_info* info = &device_info_list[i];
+
+        for (int j = 0; j < NUMBER_OF_SENSORS; j++)
+        {
+            if (info->window[j].count == 0)
+            {
+                continue;
+            }
+
+            info->closed_window[j] = info->window[j];
+            mote_window_init(&info->window[j]);
+
+            queue_sentilo_aggregate(info, j);
+        }
+    }
+}
+
+static void endpoint_open_circuit(struct endpoint* e)
+{
+    e->circuit_state = CIRCUIT_OPEN;
+    timer_set(&e->probe_timer, e->probe_interval);
+
+    PRINTF("Circuit of %s opened, next probe in %lu seconds.\n", e->name,
+        (unsigned long)(e->probe_interval / CLOCK_SECOND));
+}
+
+static void endpoint_report_success(struct endpoint* e)
+{
+    if (e->circuit_state != CIRCUIT_CLOSED)
+    {
+        PRINTF("Circuit of %s closed.\n", e->name);
+
+        // upload what was not sent meanwhile.
+        queue_sentilo_backfill(e, e->failing_since, clock_seconds());
+    }
+
+    e->circuit_state = CIRCUIT_CLOSED;
+    e->consecutive_failures = 0;
+    e->probe_interval = MS_TO_CLOCK(circuit_probe_interval);
+}
+
+static void endpoint_report_failure(struct endpoint* e)
+{
+    if (e->consecutive_failures++ == 0)
+    {
+        e->failing_since = clock_seconds();
+    }
+
+    if (e->circuit_state == CIRCUIT_HALF_OPEN)
+    {
+        // the probe failed, wait longer before the next one.
+        e->probe_interval *= 2;
+
+        if (e->probe_interval > MS_TO_CLOCK(circuit_probe_max_interval))
+        {
+            e->probe_interval = MS_TO_CLOCK(circuit_probe_max_interval);
+        }
+
+        endpoint_open_circuit(e);
+    }
+    else if (e->circuit_state == CIRCUIT_CLOSED &&
+        e->consecutive_failures >= circuit_failure_threshold)
+    {
+        endpoint_open_circuit(e);
+    }
+}
+
+static void endpoint_set_timeout(struct endpoint* e, long timeout)
+{
+    if (timeout < MS_TO_CLOCK(http_min_timeout))
+    {
+        timeout = MS_TO_CLOCK(http_min_timeout);
+    }
+    else if (timeout > MS_TO_CLOCK(http_max_timeout))
+    {
+        timeout = MS_TO_CLOCK(http_max_timeout);
+    }
+
+    e->timeout = timeout;
+}
+
+static void endpoint_update_rtt(struct endpoint* e, clock_time_t rtt)
+{
+    long delta;
+
+    // a zero sample would leave srtt at 0, which means not measured yet.
+    if (rtt == 0)
+    {
+        rtt = 1;
+    }
+
+    if (e->srtt == 0)
+    {
+        // first measurement.
+        e->srtt = (long)rtt << 3;
+        e->rttvar = (long)rtt << 1;
+    }
+    else
+    {
+        // srtt += (rtt - srtt) / 8 and rttvar += (|rtt - srtt| - rttvar) / 4.
+        delta = (long)rtt - (e->srtt >> 3);
+        e->srtt += delta;
+
+        if (delta < 0)
+        {
+            delta = -delta;
+        }
+
+        e->rttvar += delta - (e->rttvar >> 2);
+    }
+
+    // timeout = srtt + 4 * rttvar, at least one clock tick over srtt.
+    endpoint_set_timeout(e, (e->srtt >> 3) + MAX(1, e->rttvar));
+
+    PRINTF("RTT of %s: %lu ms (timeout %lu ms)\n", e->name,
+        (unsigned long)(rtt * 1000 / CLOCK_SECOND),
+        (unsigned long)(e->timeout * 1000 / CLOCK_SECOND));
+}
+
+// marks the start of a request or probe to an endpoint. Its rtt is measured
+// from here to the status line of the response, the same span the deadline of
+// the socket bounds, as it stops once the status is parsed.
+static void endpoint_start_request(struct endpoint* e)
+{
+    e->request_start = clock_time();
+}
+
+// ms since boot wrapping at 31 bits, as the sample times of the motes.
+#define LATENCY_CLOCK_MASK 0x7fffffff
+
+static uint32_t get_latency_clock()
+{
+    return (uint32_t)((uint64_t)clock_time() * 1000 / CLOCK_SECOND) &
+        LATENCY_CLOCK_MASK;
+}
+
+// returns the time in the mesh of a sample of a device taken at ts (ms in the
+// clock of the mote) and adds it to its histogram. The clocks are not
+// synchronized, so it is the time over the one of the fastest recent packet,
+// which includes the sensor reading and the queueing in the mesh but not the
+// minimum propagation time. That reference is let drift by 1 ms each packet,
+// so it follows the drift between both clocks.
+static uint32_t update_mesh_latency(struct device_info* info, uint32_t ts)
+{
+    uint32_t offset = (get_latency_clock() - ts) & LATENCY_CLOCK_MASK;
+    uint32_t transit;
+
+    // the first sample, or the mote rebooted.
+    if (!info->clock_offset_valid ||
+        ((ts - info->last_ts) & LATENCY_CLOCK_MASK) > LATENCY_CLOCK_MASK / 2)
+    {
+        info->clock_offset = offset;
+        info->clock_offset_valid = 1;
+    }
+
+    info->last_ts = ts;
+    info->clock_offset = (info->clock_offset + 1) & LATENCY_CLOCK_MASK;
+    transit = (offset - info->clock_offset) & LATENCY_CLOCK_MASK;
+
+    // faster than the reference, it is the new one.
+    if (transit > LATENCY_CLOCK_MASK / 2)
+    {
+        info->clock_offset = offset;
+        transit = 0;
+    }
+
+    latency_histogram_add(&info->latency.mesh, transit);
+
+    return transit;
+}
+
+// adds the latency of a reading uploaded to a sentilo endpoint, when the status
+// of its response is parsed.
+static void update_upload_latency(struct endpoint* e, struct http_request* r)
+{
+    struct device_info* info = &device_info_list[r->flow];
+    int target = e - endpoint_list;
+    clock_time_t now = clock_time();
+    uint32_t queue = CLOCK_TO_MS(e->request_start - r->ingest_time);
+    uint32_t http = CLOCK_TO_MS(now - e->request_start);
+
+    latency_histogram_add(&info->latency.queue[target], queue);
+    latency_histogram_add(&info->latency.http[target], http);
+
+    if (r->transit != LATENCY_UNKNOWN)
+    {
+        latency_histogram_add(&info->latency.total[target],
+            r->transit + queue + http);
+    }
+
+    PRINTF("Mote %d seq %d uploaded to %s: mesh %ld, queue %lu, http %lu ms\n",
+        r->target_id, r->seq, e->name,
+        r->transit != LATENCY_UNKNOWN ? (long)r->transit : -1L,
+        (unsigned long)queue, (unsigned long)http);
+}
+
+static void init_latency_stats(struct latency_stats* l)
+{
+    latency_histogram_init(&l->mesh);
+
+    for (int i = 0; i <= SENTILO_SECONDARY; i++)
+    {
+        latency_histogram_init(&l->queue[i]);
+        latency_histogram_init(&l->http[i]);
+        latency_histogram_init(&l->total[i]);
+    }
+}
+
+static void print_latency_histogram(const char* stage,
+    const struct latency_histogram* h)
+{
+    if (h->count == 0)
+    {
+        return;
+    }
+
+    printf("  %-12s n=%u p50<=%lu p95<=%lu max=%lu ms\n", stage, h->count,
+        (unsigned long)latency_histogram_percentile(h, 50),
+        (unsigned long)latency_histogram_percentile(h, 95),
+        (unsigned long)h->max);
+}
+
+// prints the latency of the readings of each mote, for each stage and sentilo
+// endpoint.
+static void print_latency_stats()
+{
+    for (int i = 0; i < NUMBER_OF_MOTES; i++)
+    {
+        struct latency_stats* l = &device_info_list[i].latency;
+
+        printf("Latency of mote %d\n", device_info_list[i].device_id);
+        print_latency_histogram("mesh", &l->mesh);
+
+        for (int j = 0; j <= SENTILO_SECONDARY; j++)
+        {
+            if (l->http[j].count == 0)
+            {
+                continue;
+            }
+
+            printf(" to %s\n", endpoint_list[j].name);
+            print_latency_histogram("queue", &l->queue[j]);
+            print_latency_histogram("http", &l->http[j]);
+            print_latency_histogram("end-to-end", &l->total[j]);
+        }
+    }
+}
+
+// called when the current request or probe of an endpoint got a response.
+static void endpoint_response_received(struct endpoint* e)
+{
+    // as TCP does, do not measure retried requests since it is not known which
+    // attempt is being answered.
+    if (e->current_request == NULL || e->current_request->attempts == 1)
+    {
+        endpoint_update_rtt(e, clock_time() - e->request_start);
+    }
+}
+
+// called once the result of the current request or probe of an endpoint is
+// known.
+static void finish_http_request(struct endpoint* e, HTTP_RESULT result)
+{
+    struct http_request* r = e->current_request;
+
+
+    // any response, even a rejection, means the endpoint is reachable.
+    if (result == HTTP_RESULT_FAILED)
+    {
+        endpoint_report_failure(e);
+    }
+    else
+    {
+        endpoint_report_success(e);
+    }
+
+    if (result == HTTP_RESULT_RATE_LIMITED)
+    {
+        PRINTF("%s asks to slow down, pausing it.\n", e->name);
+        timer_set(&e->rate_limit_timer, HTTP_RATE_LIMIT_PAUSE);
+    }
+
+    if (r != NULL)
+    {
+        if (result == HTTP_RESULT_RATE_LIMITED)
+        {
+            // it was not processed, so it does not count as an attempt.
+            r->attempts--;
+        }
+
+        if (result == HTTP_RESULT_RATE_LIMITED ||
+            (result == HTTP_RESULT_FAILED && r->attempts < http_max_attempts))
+        {
+            // keep the request, putting it back as the oldest one of its flow
+            // and serving that flow first, so it is the next to be sent once
+            // the endpoint works again.
+            struct endpoint* owner = get_request_owner(e, r);
+
+            list_add(owner->request_list, r);
+            owner->next_flow = r->flow;
+        }
+        else
+        {
+            if (result != HTTP_RESULT_SUCCESS)
+            {
+                PRINTF("Dropping request to %s.\n", e->name);
+            }
+
+            free_http_request(e, r);
+        }
+    }
+
+    e->current_request = NULL;
+    e->response_received = 0;
+    e->sending = 0;
+
+    // do not wait for the next period to send the next request.
+    process_poll(&border_router_and_udp_server_process);
+}
+
+// callback for parsing http responses.
+static void http_callback(struct http_socket *s, void *ptr,
+    http_socket_event_t e, const uint8_t *data, uint16_t datalen)
+{
+    struct endpoint* endpoint = ptr;
+
+    // ignore late events of a request that is already finished.
+    if (!endpoint->sending)
+    {
+        return;
+    }
+
+    if (e == HTTP_SOCKET_ERR)
+    {
+        http_socket_close(s);
+
+        // with a header the server answered with an error status, otherwise
+        // the connection failed.
+        if (data != NULL &&
+            ((const struct http_socket_header*)data)->status_code == 0x429)
+        {
+            PRINTF("HTTP socket error: too many requests\n");
+            endpoint_response_received(endpoint);
+            finish_http_request(endpoint, HTTP_RESULT_RATE_LIMITED);
+        }
+        else if (data != NULL)
+        {
+            PRINTF("HTTP socket error: request rejected\n");
+            endpoint_response_received(endpoint);
+            finish_http_request(endpoint, HTTP_RESULT_REJECTED);
+        }
+        else
+        {
+            PRINTF("HTTP socket error\n");
+            finish_http_request(endpoint, HTTP_RESULT_FAILED);
+        }
+    }
+    else if (e == HTTP_SOCKET_TIMEDOUT)
+    {
+        PRINTF("HTTP socket error: timed out\n");
+        http_socket_close(s);
+        finish_http_request(endpoint, HTTP_RESULT_FAILED);
+    }
+    else if ((e == HTTP_SOCKET_CONNECT_TIMEDOUT ||
+              e == HTTP_SOCKET_RESPONSE_TIMEDOUT ||
+              e == HTTP_SOCKET_DEADLINE_EXCEEDED) &&
+             endpoint->response_received)
+    {
+        // the answer already arrived, only the close was slow.
+        finish_http_request(endpoint, HTTP_RESULT_SUCCESS);
+    }
+    else if (e == HTTP_SOCKET_CONNECT_TIMEDOUT ||
+             e == HTTP_SOCKET_RESPONSE_TIMEDOUT ||
+             e == HTTP_SOCKET_DEADLINE_EXCEEDED)
+    {
+        // the socket has already been closed by http-socket.
+        PRINTF("Previous HTTP request to %s timeout.\n", endpoint->name);
+
+        // as TCP does, back off the timeout until a new measurement is done.
+        endpoint_set_timeout(endpoint, 2 * endpoint->timeout);
+
+        finish_http_request(endpoint, HTTP_RESULT_FAILED);
+    }
+    else if (e == HTTP_SOCKET_ABORTED)
+    {
+        PRINTF("HTTP socket error: aborted\n");
+        http_socket_close(s);
+        finish_http_request(endpoint, HTTP_RESULT_FAILED);
+    }
+    else if (e == HTTP_SOCKET_HOSTNAME_NOT_FOUND)
+    {
+        PRINTF("HTTP socket error: hostname not found\n");
+        http_socket_close(s);
+        finish_http_request(endpoint, HTTP_RESULT_FAILED);
+    }
+    else if (e == HTTP_SOCKET_HEADER)
+    {
+        // only the status is asked for, the connection is already closing.
+        PRINTF("HTTP status %x from %s\n",
+            ((const struct http_socket_header*)data)->status_code,
+            endpoint->name);
+
+        endpoint->response_received = 1;
+        endpoint_response_received(endpoint);
+
+        // the reading is uploaded once acknowledged, the close that follows
+        // is not part of its latency.
+        if (endpoint->current_request != NULL &&
+            endpoint->target_type == SENTILO &&
+            endpoint->current_request->kind == SENTILO_READING)
+        {
+            struct http_request* r = endpoint->current_request;
+
+            update_upload_latency(endpoint, r);
+            update_last_upload(r->target_id, r->data_type, r->value);
+        }
+    }
+    else if (e == HTTP_SOCKET_CLOSED)
+    {
+        http_socket_close(s);
+
+        // closed before any response arrived, the request did not reach it.
+        if (endpoint->response_received)
+        {
+            finish_http_request(endpoint, HTTP_RESULT_SUCCESS);
+        }
+        else
+        {
+            finish_http_request(endpoint, HTTP_RESULT_FAILED);
+        }
+    }
+    else
+    {
+        PRINTF("UNKNOWN event\n");
+    }
+}
+
+// prepares the socket of an endpoint for a new request.
+static void init_endpoint_socket(struct endpoint* e)
+{
+    const uip_ipaddr_t* addr = uplink_dns_get(e->dns_host);
+
+    // init the socket.
+    http_socket_init(&e->socket);
+    // set the headers (identity key).
+    http_socket_set_headers(&e->socket, &e->headers);
+    // the whole request, from connecting to the last byte of the response,
+    // must fit in the adaptive timeout of the endpoint.
+    http_socket_set_timeouts(&e->socket, 0, 0, e->timeout);
+
+    // only the status code of the responses is needed, so the connection is
+    // closed as soon as it arrives and the body is never copied.
+    http_socket_set_response_mode(&e->socket, HTTP_SOCKET_RESPONSE_STATUS);
+
+    // use the cached address of the host so dns is never waited for.
+    if (addr != NULL)
+    {
+        http_socket_set_host_address(&e->socket, addr);
+    }
+}
+
+// sends a cheap request to an endpoint to know if it is reachable and how
+// long it takes to answer.
+static void send_probe(struct endpoint* e)
+{
+    char url[HTTP_SOCKET_URLLEN];
+    struct json_writer w;
+
+    json_writer_init(&w, url, sizeof(url));
+    json_writer_raw(&w, e->url);
+
+    if (e->target_type == TELEGRAM)
+    {
+        json_writer_raw(&w, "/bot" TELEGRAM_BOT_TOKEN "/getMe");
+    }
+
+    PRINTF("Probing %s...\n", e->name);
+
+    e->sending = 1;
+    e->current_request = NULL;
+
+    if (e->circuit_state == CIRCUIT_OPEN)
+    {
+        e->circuit_state = CIRCUIT_HALF_OPEN;
+    }
+
+    timer_set(&e->probe_timer, e->probe_interval);
+
+    endpoint_start_request(e);
+    init_endpoint_socket(e);
+    // do the request, an invalid url fails at once.
+    if (json_writer_overflow(&w) ||
+        http_socket_get(&e->socket, url, 0, 0, http_callback, e) !=
+        HTTP_SOCKET_OK)
+    {
+        finish_http_request(e, HTTP_RESULT_FAILED);
+    }
+}
 
-// define max data in and out.
-#define MAX_HTTP_DATA_IN 512
-#define MAX_HTTP_DATA_OUT 256
+// writes the time of a sample, in seconds since boot, as a sentilo timestamp:
+// dd/MM/yyyyTHH:mm:ss in UTC.
+static void write_sentilo_timestamp(struct json_writer* w, uint32_t time)
+{
+    uint32_t t = wall_clock_offset + time;
+    uint32_t secs = t % 86400;
+    // civil date of the days since 1970-01-01, with years starting in march.
+    uint32_t z = t / 86400 + 719468;
+    uint32_t era = z / 146097;
+    uint32_t doe = z - era * 146097;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    unsigned long day = doy - (153 * mp + 2) / 5 + 1;
+    unsigned long month = mp < 10 ? mp + 3 : mp - 9;
+    unsigned long year = yoe + era * 400 + (month <= 2);
+    char str[24];
+
+    snprintf(str, sizeof(str), "%02lu/%02lu/%04luT%02lu:%02lu:%02lu", day,
+        month, year, (unsigned long)secs / 3600,
+        (unsigned long)secs / 60 % 60, (unsigned long)secs % 60);
+
+    json_writer_raw(w, str);
+}
 
-// {"chat_id":"-XXXXXXXXXXXXX","text":""} + \0
-#define MIN_TELEGRAM_MSG_SIZE 39
+// body of a backfill request, streamed in parts as the socket takes them:
+// {"sensors":[{"sensor":"mote_1_temp","observations":[{"value":"23.5",
+// "timestamp":"18/10/2026T10:00:00"},...]},...]}
+struct backfill_stream
+{
+    const struct device_info* info;
+    uint32_t from;
+    uint32_t to;
+    // sensors with samples in the range and the one being written,
+    // NUMBER_OF_SENSORS once all of them are.
+    uint8_t sensors;
+    uint8_t sensor;
+    char started;
+    char in_sensor;
+    char first;
+    char done;
+    struct sample_history_cursor cursor;
+    // part written but not yet taken by the socket.
+    char part[96];
+    uint8_t part_len;
+    uint8_t part_pos;
+};
 
-// maximum chars for storing string data for each device. It depend on the max
-// http output data.
-#define MAX_DEVICE_STRING_DATA MAX_HTTP_DATA_OUT
+static struct backfill_stream backfill_streams[SENTILO_SECONDARY + 1];
 
-// var to control if a request is still in process.
-static int sending_http_request = 0;
+static uint8_t next_backfill_sensor(struct backfill_stream* b, uint8_t sensor)
+{
+    while (sensor < NUMBER_OF_SENSORS && !(b->sensors & (1 << sensor)))
+    {
+        sensor++;
+    }
 
-// vars to control http responses.
-static int http_bytes_received = 0;
-static char http_data_received[MAX_HTTP_DATA_IN];
+    return sensor;
+}
 
-// the UDP connection.
-static struct uip_udp_conn* server_conn;
-// a json parser for parsing the content of the packets.
-static struct jsonparse_state js_p_state;
+// writes the next part of a backfill body, returns 0 once it is finished.
+static int write_backfill_part(struct backfill_stream* b)
+{
+    struct sample_history_sample sample;
+    struct json_writer w;
 
-// timers to manage times when sending http requests.
-static struct etimer http_requests_timer;
-static struct etimer http_requests_timeout_timer;
+    if (b->done)
+    {
+        return 0;
+    }
 
-// a socket for sending http request.
-static struct http_socket socket;
+    json_writer_init(&w, b->part, sizeof(b->part));
+    b->part_pos = 0;
 
-typedef enum {SENTILO, TELEGRAM} TARGET_TYPE;
-typedef enum {TEMP, HUM, LIGHT, BATT, PDR, OTHER} DATA_TYPE;
+    if (!b->started)
+    {
+        json_writer_raw(&w, "{\"sensors\":[");
+        b->started = 1;
+        b->first = 1;
+    }
+    else if (b->sensor >= NUMBER_OF_SENSORS)
+    {
+        json_writer_raw(&w, "]}");
+        b->done = 1;
+    }
+    else if (!b->in_sensor)
+    {
+        json_writer_raw(&w, b->first ? "{\"sensor\":\"" : ",{\"sensor\":\"");
+        write_sensor_name(&w, b->info->device_id, b->sensor, "");
+        json_writer_raw(&w, "\",\"observations\":[");
 
-// struct for storing the content of an http request.
-struct http_request
-{
-    struct http_request* next;
-    TARGET_TYPE target_type;
-    int target_id;
-    DATA_TYPE data_type;
-    char data[6];
-    // pointer to a char array that can contain extra data.
-    char* large_data;
-};
+        sample_history_cursor_init(&b->cursor, &b->info->history);
+        b->in_sensor = 1;
+        b->first = 1;
+    }
+    else
+    {
+        // the next sample of the sensor in the range, if any.
+        while (sample_history_next(&b->cursor, &sample))
+        {
+            if (sample.time < b->from || sample.time >= b->to ||
+                !(sample.mask & (1 << b->sensor)))
+            {
+                continue;
+            }
 
-// struct for storing device info/data.
-struct device_info {
-    int device_id;
-    char f_update_sensors_data_on_telegram;
-    char f_low_pdr;
-    int packets_received;
-    int packets_sent;
-    char data[MAX_DEVICE_STRING_DATA];
-};
+            json_writer_raw(&w, b->first ? "{\"value\":\"" : ",{\"value\":\"");
+            write_sensor_value(&w, b->sensor, sample.values[b->sensor]);
+            json_writer_raw(&w, "\",\"timestamp\":\"");
+            write_sentilo_timestamp(&w, sample.time);
+            json_writer_raw(&w, "\"}");
+            b->first = 0;
 
-// declare a list of device info, one for each mote.
-struct device_info device_info_list[NUMBER_OF_MOTES];
+            b->part_len = json_writer_length(&w);
+            return 1;
+        }
 
-// declare a list of http requests.
-LIST(http_request_list);
-MEMB(http_request_mem, struct http_request, MAX_HTTP_REQUESTS);
+        json_writer_raw(&w, "]}");
+        b->in_sensor = 0;
+        b->first = 0;
+        b->sensor = next_backfill_sensor(b, b->sensor + 1);
+    }
 
-PROCESS(border_router_and_udp_server_process, "Border Router and UDP server process");
-AUTOSTART_PROCESSES(&border_router_and_udp_server_process);
+    b->part_len = json_writer_length(&w);
+    return 1;
+}
 
-// function that returns the info struct of a specific device.
-static struct device_info* get_device_info(int target_device_id)
+// hands the body of a backfill request to the socket.
+static uint16_t backfill_producer(struct http_socket* s, void* ptr,
+    uint8_t* buf, uint16_t maxlen)
 {
-    struct device_info* info = NULL;
+    struct endpoint* e = ptr;
+    struct backfill_stream* b = &backfill_streams[e - endpoint_list];
+    uint16_t len = 0;
+    uint16_t n;
 
-    for (int i = 0; i < NUMBER_OF_MOTES; i++)
+    while (len < maxlen)
     {
-        if (device_info_list[i].device_id == target_device_id)
+        if (b->part_pos == b->part_len && !write_backfill_part(b))
         {
-            info = &device_info_list[i];
-
             break;
         }
+
+        n = b->part_len - b->part_pos;
+        if (n > maxlen - len)
+        {
+            n = maxlen - len;
+        }
+
+        memcpy(buf + len, b->part + b->part_pos, n);
+        b->part_pos += n;
+        len += n;
     }
 
-    return info;
+    return len;
 }
 
-static void get_data_type_as_string(DATA_TYPE dt, char* out)
+static int send_sentilo_request(struct endpoint* e, struct http_request* r)
 {
-    switch (dt)
+    // prepare the request.
+    PRINTF("Preparing to send request to %s...\n", e->name);
+
+    char url[HTTP_SOCKET_URLLEN];
+    struct json_writer w;
+
+    if (r->kind == SENTILO_BACKFILL)
     {
-        case TEMP:
-            sprintf(out, "temp");
-            break;
+        struct backfill_stream* b = &backfill_streams[e - endpoint_list];
+
+        // the history of a mote is put to {url}, it is written again from the
+        // start each time the request is sent.
+        b->info = get_device_info(r->target_id);
+        b->from = r->range.from;
+        b->to = r->range.to;
+        b->sensors = get_history_sensors(b->info, b->from, b->to, NULL);
+        b->sensor = next_backfill_sensor(b, 0);
+        b->started = 0;
+        b->in_sensor = 0;
+        b->done = 0;
+        b->part_len = 0;
+        b->part_pos = 0;
+
+        init_endpoint_socket(e);
+        return http_socket_put_stream(&e->socket, e->url,
+            HTTP_SOCKET_LENGTH_UNKNOWN, "application/json", backfill_producer,
+            http_callback, e);
+    }
 
-        case HUM:
-            sprintf(out, "hum");
-            break;
+    if (r->kind == SENTILO_AGGREGATE)
+    {
+        char* body = sentilo_body[e - endpoint_list];
 
-        case LIGHT:
-            sprintf(out, "light");
-            break;
+        // the aggregates of several sensors are put to {url} at once.
+        json_writer_init(&w, body, SENTILO_AGGREGATE_BODY_SIZE);
+        write_sentilo_aggregates(&w, r->target_id, r->data_type, &r->window);
 
-        case BATT:
-            sprintf(out, "batt");
-            break;
+        // it would not fit the next time either, drop it as an invalid url.
+        if (json_writer_overflow(&w))
+        {
+            PRINTF("Aggregates of mote %d do not fit.\n", r->target_id);
+            return HTTP_SOCKET_INVALID_URL;
+        }
 
-        case PDR:
-            sprintf(out, "pdr");
-            break;
+        init_endpoint_socket(e);
+        return http_socket_put(&e->socket, e->url, body,
+            json_writer_length(&w), "application/json", http_callback, e);
+    }
 
-        case OTHER:
-            // do nothing.
-            break;
+    char data_type_string[8];
+    get_data_type_as_string(r->data_type, data_type_string);
 
-        default:
-            // do nothing.
-            break;
+    // {url}/mote_{id}_{sensor}/{value}
+    json_writer_init(&w, url, sizeof(url));
+    json_writer_raw(&w, e->url);
+    json_writer_raw(&w, "/mote_");
+    json_writer_int(&w, r->target_id);
+    json_writer_raw(&w, "_");
+    json_writer_raw(&w, data_type_string);
+    json_writer_raw(&w, "/");
+    write_sensor_value(&w, r->data_type, r->value);
+
+    if (json_writer_overflow(&w))
+    {
+        return HTTP_SOCKET_INVALID_URL;
     }
+
+    init_endpoint_socket(e);
+    // do the request.
+    return http_socket_put(&e->socket, url, NULL, 0, "application/json",
+        http_callback, e);
 }
 
-// callback for parsing http responses.
-static void http_callback(struct http_socket *s, void *ptr,
-    http_socket_event_t e, const uint8_t *data, uint16_t datalen)
+static int send_telegram_request(struct endpoint* e, struct http_request* r)
 {
-    if (e == HTTP_SOCKET_ERR)
+    PRINTF("Preparing to send request to Telegram API...\n");
+
+    char url[HTTP_SOCKET_URLLEN];
+    struct json_writer w;
+
+    json_writer_init(&w, url, sizeof(url));
+    json_writer_raw(&w, e->url);
+    json_writer_raw(&w, "/bot" TELEGRAM_BOT_TOKEN "/sendMessage");
+
+    if (json_writer_overflow(&w))
     {
-        PRINTF("HTTP socket error\n");
-        http_bytes_received = 0;
-        http_data_received[0] = 0;
-        http_socket_close(s);
-        sending_http_request = 0;
+        return HTTP_SOCKET_INVALID_URL;
     }
-    else if (e == HTTP_SOCKET_TIMEDOUT)
+
+    init_endpoint_socket(e);
+    // do the request.
+    return http_socket_post(&e->socket, url, r->large_data,
+        strlen(r->large_data), "application/json", http_callback, e);
+}
+
+// removes from the queue of an endpoint its next request, if it has to send
+// any. The flows (motes) are served in round-robin order, taking the oldest
+// request of each one, so every mote gets its share of the endpoint.
+static struct http_request* take_next_http_request(struct endpoint* e)
+{
+    struct endpoint* owner = get_queue_owner(e);
+    struct http_request* r;
+    struct http_request* next = NULL;
+    unsigned int distance;
+    unsigned int next_distance = 0;
+
+    // in failover mode only the preferred sentilo endpoint sends requests.
+    if (sentilo_mode == SENTILO_MODE_FAILOVER && e->target_type == SENTILO &&
+        e != get_preferred_sentilo_endpoint())
     {
-        PRINTF("HTTP socket error: timed out\n");
-        http_bytes_received = 0;
-        http_data_received[0] = 0;
-        http_socket_close(s);
-        sending_http_request = 0;
+        return NULL;
     }
-    else if (e == HTTP_SOCKET_ABORTED)
+
+    // the newest requests are at the head, so the oldest one of the flow
+    // nearest to next_flow is the last one found with the minimum distance.
+    for (r = list_head(owner->request_list); r != NULL; r = r->next)
     {
-        PRINTF("HTTP socket error: aborted\n");
-        http_bytes_received = 0;
-        http_data_received[0] = 0;
-        http_socket_close(s);
-        sending_http_request = 0;
+        distance = (unsigned int)(r->flow - owner->next_flow);
+
+        if (next == NULL || distance <= next_distance)
+        {
+            next = r;
+            next_distance = distance;
+        }
     }
-    else if (e == HTTP_SOCKET_HOSTNAME_NOT_FOUND)
+
+    if (next != NULL)
     {
-        PRINTF("HTTP socket error: hostname not found\n");
-        http_bytes_received = 0;
-        http_data_received[0] = 0;
-        http_socket_close(s);
-        sending_http_request = 0;
+        list_remove(owner->request_list, next);
+        owner->next_flow = next->flow + 1;
     }
-    else if (e == HTTP_SOCKET_CLOSED)
+
+    return next;
+}
+
+static void send_endpoint_requests(struct endpoint* e)
+{
+    // if it is not configured or still sending a request, nothing to do.
+    if (e->url == NULL || e->sending)
     {
-        if (http_bytes_received > 0)
-        {
-            if (http_bytes_received > MAX_HTTP_DATA_IN - 1)
-            {
-                PRINTF("(Received data overflows the maximum!)\n");
-            }
+        return;
+    }
 
-            PRINTF("HTTP socket received data:\n%s\n", http_data_received);
-        }
-        else
+    // while the circuit is open requests are held, only probes are sent.
+    if (e->circuit_state != CIRCUIT_CLOSED)
+    {
+        if (timer_expired(&e->probe_timer))
         {
-            PRINTF("No bytes received.\n");
+            send_probe(e);
         }
 
-        http_bytes_received = 0;
-        http_data_received[0] = 0;
-        http_socket_close(s);
-        sending_http_request = 0;
+        return;
+    }
+
+    // after a 429 the requests are held until the pause ends.
+    if (!timer_expired(&e->rate_limit_timer))
+    {
+        return;
+    }
+
+    // get a request from the waiting list, within the rate limit.
+    struct http_request* r = NULL;
+
+    if (token_bucket_available(&e->bucket) > 0)
+    {
+        r = take_next_http_request(e);
     }
-    else if (e == HTTP_SOCKET_DATA)
+
+    // if there is a request to send...
+    if (r != NULL)
     {
-        // if there are enough space (-1 because \0 char)...
-        if (http_bytes_received < MAX_HTTP_DATA_IN - 1)
+        int ret;
+
+        // keep it until the result is known.
+        token_bucket_take(&e->bucket);
+        e->sending = 1;
+        e->current_request = r;
+        r->attempts++;
+        endpoint_start_request(e);
+
+        // check the target type.
+        if (e->target_type == SENTILO)
         {
-            // if income data is less than the rest of the space...
-            if (datalen < MAX_HTTP_DATA_IN - http_bytes_received - 1)
-            {
-                // just copy it.
-                strncat(http_data_received, (const char *)data,
-                    datalen);
-            }
-            else
-            {
-                // if more than the rest of the space, copy the maximum.
-                strncat(http_data_received, (const char *)data,
-                    MAX_HTTP_DATA_IN - http_bytes_received - 1);
-            }
+            ret = send_sentilo_request(e, r);
         }
         else
         {
-            // not enough space, do not copy data.
+            ret = send_telegram_request(e, r);
         }
 
-        http_bytes_received += datalen;
-
-        printf("HTTP socket received %d bytes of data\n", datalen);
+        if (ret == HTTP_SOCKET_INVALID_URL)
+        {
+            // it would fail the same way each time it is retried.
+            PRINTF("Request to %s has an invalid url, dropping it.\n",
+                e->name);
+            free_http_request(e, r);
+            e->current_request = NULL;
+            e->sending = 0;
+            return;
+        }
+        else if (ret != HTTP_SOCKET_OK)
+        {
+            // the host could not be resolved or there were no free buffers,
+            // it is retried as any other failed request.
+            finish_http_request(e, HTTP_RESULT_FAILED);
+            return;
+        }
+    }
+    else if (sentilo_mode == SENTILO_MODE_FAILOVER &&
+        e->target_type == SENTILO &&
+        e != get_preferred_sentilo_endpoint() &&
+        timer_expired(&e->probe_timer))
+    {
+        // the idle sentilo endpoint is working, keep measuring it to know
+        // when to switch: the primary one while it is too slow, the secondary
+        // one while the primary is preferred.
+        send_probe(e);
     }
     else
     {
-        PRINTF("UNKNOWN event\n");
+        // there are no request in the list, nothing to do.
+        //PRINTF("No HTTP requests remaining.\n");
     }
 }
 
 static void send_http_requests()
 {
-    // if is not sending any request...
-    if (!sending_http_request)
+    for (int i = 0; i < NUMBER_OF_ENDPOINTS; i++)
     {
-        // get a request from the waiting list.
-        struct http_request* r = list_chop(http_request_list);
-
-        // if there is a request to send...
-        if (r != NULL)
-        {
-            // check the target type.
-            if (r->target_type == SENTILO)
-            {
-                // prepare the request.
-                sending_http_request = 1;
-                PRINTF("Preparing to send request to Sentilo...\n");
-
-                char header[HTTP_SOCKET_CUSTOM_HEADER_LEN];
-                char url[HTTP_SOCKET_URLLEN];
-
-                snprintf(header, HTTP_SOCKET_CUSTOM_HEADER_LEN - 1,
-                    "IDENTITY_KEY: %s", SENTILO_TOKEN);
-
-                char data_type_string[8];
-                get_data_type_as_string(r->data_type, data_type_string);
-
-                snprintf(url, HTTP_SOCKET_URLLEN - 1,
-                    "%s/mote_%d_%s/%s",
-                    SENTILO_URL,
-                    r->target_id,
-                    data_type_string,
-                    r->data);
-
-                // do not need request info anymore.
-                memb_free(&http_request_mem, r);
-
-                // init the socket.
-                http_socket_init(&socket);
-                // set the identity key header.
-                http_socket_set_custom_header(&socket, header);
-                // do the request.
-                http_socket_put(&socket, url, NULL, 0, "application/json",
-                    http_callback, NULL);
-
-                // set the timeout timer.
-                etimer_set(&http_requests_timeout_timer, HTTP_REQUESTS_TIMEOUT_TIME);
-            }
-            else if (r->target_type == TELEGRAM)
-            {
-                sending_http_request = 1;
+        send_endpoint_requests(&endpoint_list[i]);
+    }
+}
 
-                PRINTF("Preparing to send request to Telegram API...\n");
+// sets up an endpoint, url can be NULL if it is not configured.
+static void init_endpoint(struct endpoint* e, const char* name,
+    const char* url, TARGET_TYPE target_type, const char* token,
+    int max_requests)
+{
+    e->name = name;
+    e->url = url;
+    e->target_type = target_type;
+    e->header[0] = 0;
+    e->header_list[0] = e->header;
 
-                char url[HTTP_SOCKET_URLLEN];
+    if (token != NULL)
+    {
+        snprintf(e->header, HTTP_SOCKET_CUSTOM_HEADER_LEN - 1,
+            "IDENTITY_KEY: %s", token);
+    }
+    http_socket_header_set_init(&e->headers, e->header_list,
+        token != NULL ? 1 : 0);
+
+    LIST_STRUCT_INIT(e, request_list);
+    e->max_requests = max_requests;
+    e->next_flow = 0;
+    token_bucket_init(&e->bucket, HTTP_ENDPOINT_BURST,
+        MS_TO_CLOCK(http_endpoint_interval));
+
+    e->current_request = NULL;
+    e->sending = 0;
+    e->response_received = 0;
+
+    timer_set(&e->rate_limit_timer, 0);
+
+    // closed (working) at start.
+    e->circuit_state = CIRCUIT_CLOSED;
+    e->consecutive_failures = 0;
+    e->probe_interval = MS_TO_CLOCK(circuit_probe_interval);
+    timer_set(&e->probe_timer, e->probe_interval);
+    e->srtt = 0;
+    e->rttvar = 0;
+    e->timeout = HTTP_REQUESTS_TIMEOUT_TIME;
+
+    // resolve its host in the background.
+    e->dns_host = url != NULL ? uplink_dns_add(url) : -1;
+}
 
-                snprintf(url, HTTP_SOCKET_URLLEN - 1,
-                    "%s/bot%s/sendMessage", TELEGRAM_API_URL, TELEGRAM_BOT_TOKEN);
+// sends a probe back to the mote it came from, as it is.
+static void echo_probe()
+{
+    char buf[MAX_PROBE_LEN];
+    uip_ipaddr_t addr;
+    uint16_t len = uip_datalen();
 
-                // init the socket.
-                http_socket_init(&socket);
-                // do the request.
-                http_socket_post(&socket, url, r->large_data,
-                    strlen(r->large_data), "application/json", http_callback,
-                    NULL);
+    if (len > sizeof(buf) || !token_bucket_take(&probe_echo_bucket))
+    {
+        probes_dropped++;
+        return;
+    }
 
-                // do not need request info anymore.
-                memb_free(&http_request_mem, r);
+    // sending reuses the buffer of the received packet.
+    memcpy(buf, uip_appdata, len);
+    uip_ipaddr_copy(&addr, &UIP_IP_BUF->srcipaddr);
 
-                // set the timeout timer.
-                etimer_set(&http_requests_timeout_timer, HTTP_REQUESTS_TIMEOUT_TIME);
-            }
-            else
-            {
-                // unknown target type, nothing to do.
-            }
-        }
-        else
-        {
-            // there are no request in the list, nothing to do.
-            //PRINTF("No HTTP requests remaining.\n");
-        }
-    }
-    else
-    {
-        PRINTF("Still sending previous HTTP request.\n");
+    uip_udp_packet_sendto(server_conn, buf, len, &addr,
+        UIP_HTONS(UDP_CLIENT_PORT));
 
-        if (etimer_expired(&http_requests_timeout_timer))
-        {
-            PRINTF("Previous HTTP request timeout.\n");
-            http_socket_close(&socket);
-            sending_http_request = 0;
-            http_bytes_received = 0;
-            http_data_received[0] = 0;
-        }
-    }
+    probes_echoed++;
 }
 
 static void tcpip_handler(void)
 {
     if (uip_newdata())
     {
+        struct ingress_limit* source_limit;
+        int was_cooling;
+
+        // round-trip probes do not wait for anything else.
+        if (uip_datalen() >= sizeof(PROBE_PREFIX) - 1 &&
+            memcmp(uip_appdata, PROBE_PREFIX, sizeof(PROBE_PREFIX) - 1) == 0)
+        {
+            echo_probe();
+            return;
+        }
+
+        source_limit =
+            ingress_limit_source(&UIP_IP_BUF->srcipaddr);
+        was_cooling = ingress_limit_cooling(source_limit);
+
+        // drop the packets of a flooding source before parsing them.
+        if (!ingress_limit_accept(source_limit))
+        {
+            ingress_dropped++;
+
+            if (!was_cooling)
+            {
+                PRINTF("Too many packets from ");
+                PRINT6ADDR(&UIP_IP_BUF->srcipaddr);
+                PRINTF(", ignoring it for a while.\n");
+            }
+
+            return;
+        }
+
         ((char *)uip_appdata)[uip_datalen()] = 0;
         //PRINTF("DATA recv '%s' from ", (char *)uip_appdata);
         PRINTF("Server received data from %d\n",
@@ -413,14 +2381,14 @@ static void tcpip_handler(void)
         int batt_received = 0;
         int light = 0;
         int light_received = 0;
+        uint32_t ts = 0;
+        int ts_received = 0;
         int pdr = 0;
 
         // some flags that will help later deciding which messages are needed to
         // be sent.
         char f_mote_test = 0;
         char f_sensor_error = 0;
-        char f_high_temperature = 0;
-        char f_low_battery = 0;
 
         // parse the json and store its content.
         while ((json_type = jsonparse_next(&js_p_state)) != 0)
@@ -436,6 +2404,28 @@ static void tcpip_handler(void)
                     device_id_received = 1;
 
                     PRINTF("id: %d\n", device_id);
+
+                    // a mote can also flood from several addresses, check its
+                    // id before parsing the rest.
+                    struct device_info* info = get_device_info(device_id);
+
+                    if (info != NULL)
+                    {
+                        was_cooling = ingress_limit_cooling(&info->ingress);
+
+                        if (!ingress_limit_accept(&info->ingress))
+                        {
+                            ingress_dropped++;
+
+                            if (!was_cooling)
+                            {
+                                PRINTF("Too many packets from mote %d, "
+                                    "ignoring it for a while.\n", device_id);
+                            }
+
+                            return;
+                        }
+                    }
                 }
                 else if (jsonparse_strcmp_value(&js_p_state, "typ") == 0)
                 {
@@ -470,6 +2460,14 @@ static void tcpip_handler(void)
 
                     PRINTF("seq: %d\n", seq_id);
                 }
+                else if (jsonparse_strcmp_value(&js_p_state, "ts") == 0)
+                {
+                    // get the time of the sample on the mote.
+                    json_type = jsonparse_next(&js_p_state);
+                    ts = jsonparse_get_value_as_long(&js_p_state);
+
+                    ts_received = 1;
+                }
                 else if (jsonparse_strcmp_value(&js_p_state, "temp") == 0)
                 {
                     // get the temperature value.
@@ -490,13 +2488,6 @@ static void tcpip_handler(void)
                         temp_received = 1;
 
                         PRINTF("temp: %d.%d\n", temp / 10, temp % 10);
-
-                        // if temperature is greater or equal than the limit
-                        // register alert.
-                        if ((temp/10) >= MOTE_HIGH_TEMP_LIMIT)
-                        {
-                            f_high_temperature = 1;
-                        }
                     }
                 }
                 else if (jsonparse_strcmp_value(&js_p_state, "hum") == 0)
@@ -530,13 +2521,6 @@ static void tcpip_handler(void)
                     batt_received = 1;
 
                     PRINTF("batt: %d\n", batt);
-
-                    // if battery is less or equal than the limit register
-                    // alert.
-                    if (batt <= MOTE_LOW_BATTERY_LIMIT)
-                    {
-                        f_low_battery = 1;
-                    }
                 }
                 else if (jsonparse_strcmp_value(&js_p_state, "light") == 0)
                 {
@@ -568,34 +2552,57 @@ static void tcpip_handler(void)
                 // if it was a test msg...
                 if (f_mote_test)
                 {
-                    // continue the communication test through a request to
+                    // continue the communication test through a message to
                     // telegram.
-                    char msg[MAX_DEVICE_STRING_DATA - MIN_TELEGRAM_MSG_SIZE] = "\0";
+                    struct json_writer* w = telegram_digest_add(
+                        &telegram_digests[TELEGRAM_PRIVATE_CHAT]);
 
-                    struct http_request* r = NULL;
-                    r = (struct http_request*) memb_alloc(&http_request_mem);
-
-                    if (r != NULL)
+                    if (w != NULL)
                     {
-                        r->target_type = TELEGRAM;
-
-                        snprintf(msg, MAX_DEVICE_STRING_DATA - MIN_TELEGRAM_MSG_SIZE -1,
-                            "Mote %d communication test",
-                            device_id);
-
-                        snprintf(current_device_info->data, MAX_DEVICE_STRING_DATA -1,
-                            "{\"chat_id\":\"%s\",\"text\":\"%s\"}",
-                            TELEGRAM_PRIVATE_CHAT_ID,
-                            msg);
-
-                        r->data_type = OTHER;
-                        r->large_data = current_device_info->data;
-
-                        list_push(http_request_list, r);
+                        json_writer_escaped(w, "Mote ");
+                        json_writer_int(w, device_id);
+                        json_writer_escaped(w, " communication test");
                     }
                 }
                 else
                 {
+                    // alerts raised or cleared by this packet.
+                    mote_alert_event_t sensor_error_event = MOTE_ALERT_NONE;
+                    mote_alert_event_t high_temp_event = MOTE_ALERT_NONE;
+                    mote_alert_event_t low_battery_event = MOTE_ALERT_NONE;
+                    mote_alert_event_t low_pdr_event = MOTE_ALERT_NONE;
+                    mote_alert_event_t anomaly_events[NUMBER_OF_SENSORS] =
+                        {MOTE_ALERT_NONE};
+                    int values[NUMBER_OF_SENSORS];
+
+                    values[TEMP] = temp;
+                    values[HUM] = hum;
+                    values[LIGHT] = light;
+                    values[BATT] = batt;
+
+                    current_device_info->seen = 1;
+                    current_device_info->last_seen = clock_time();
+
+                    // measure the time of the sample in the mesh.
+                    current_device_info->last_transit = ts_received ?
+                        update_mesh_latency(current_device_info, ts) :
+                        LATENCY_UNKNOWN;
+
+                    // keep the sample in the history of the mote.
+                    {
+                        int32_t history_values[NUMBER_OF_SENSORS] =
+                            {temp, hum, light, batt};
+                        uint8_t mask = (temp_received << TEMP) |
+                            (hum_received << HUM) | (light_received << LIGHT) |
+                            (batt_received << BATT);
+
+                        if (mask != 0)
+                        {
+                            sample_history_add(&current_device_info->history,
+                                clock_seconds(), mask, history_values);
+                        }
+                    }
+
                     // if received a sequence id...
                     if (seq_id_received)
                     {
@@ -608,20 +2615,9 @@ static void tcpip_handler(void)
                         else
                         {
                             // else send info to sentilo.
-                            struct http_request* r = NULL;
-                            r = (struct http_request*) memb_alloc(&http_request_mem);
-
                             pdr = (100*current_device_info->packets_received)/current_device_info->packets_sent;
 
-                            if (r != NULL)
-                            {
-                                r->target_type = SENTILO;
-                                r->target_id = device_id;
-                                r->data_type = PDR;
-                                sprintf(r->data, "%d", pdr);
-
-                                list_push(http_request_list, r);
-                            }
+                            queue_sentilo_request(device_id, PDR, pdr);
 
                             // and then reset stats and update pdr counter again.
                             current_device_info->packets_received = 1;
@@ -631,153 +2627,185 @@ static void tcpip_handler(void)
                             // activate flag and do it later.
                             current_device_info->f_update_sensors_data_on_telegram = 1;
 
-                            // if pdr is low, register alert.
-                            if (pdr <= MOTE_LOW_PDR_LIMIT)
-                            {
-                                current_device_info->f_low_pdr = 1;
-                            }
+                            // check if pdr is low.
+                            low_pdr_event = mote_alert_update(
+                                &current_device_info->low_pdr_alert,
+                                pdr <= low_pdr_limit,
+                                pdr > low_pdr_limit + MOTE_LOW_PDR_HYSTERESIS);
                         }
                     }
 
+                    // update the statistics and check the alerts, they are
+                    // only reported when raised or cleared.
+                    sensor_error_event = mote_alert_update(
+                        &current_device_info->sensor_error_alert,
+                        f_sensor_error, temp_received && hum_received);
+
+                    if (temp_received)
+                    {
+                        high_temp_event = mote_alert_update(
+                            &current_device_info->high_temp_alert,
+                            temp >= high_temp_limit * 10,
+                            temp < (high_temp_limit - MOTE_HIGH_TEMP_HYSTERESIS) * 10);
+
+                        anomaly_events[TEMP] =
+                            update_sensor_stats(current_device_info, TEMP, temp);
+                    }
+
+                    if (hum_received)
+                    {
+                        anomaly_events[HUM] =
+                            update_sensor_stats(current_device_info, HUM, hum);
+                    }
+
+                    if (batt_received)
+                    {
+                        low_battery_event = mote_alert_update(
+                            &current_device_info->low_battery_alert,
+                            batt <= low_battery_limit,
+                            batt > low_battery_limit + MOTE_LOW_BATTERY_HYSTERESIS);
+
+                        anomaly_events[BATT] =
+                            update_sensor_stats(current_device_info, BATT, batt);
+                    }
+
+                    if (light_received)
+                    {
+                        anomaly_events[LIGHT] =
+                            update_sensor_stats(current_device_info, LIGHT, light);
+                    }
+
                     // if received temperature...
                     if (temp_received)
                     {
                         // add a request to update sentilo info.
-                        struct http_request* r = NULL;
-                        r = (struct http_request*) memb_alloc(&http_request_mem);
-
-                        if (r != NULL)
-                        {
-                            r->target_type = SENTILO;
-                            r->target_id = device_id;
-                            r->data_type = TEMP;
-                            sprintf(r->data, "%d.%d", temp / 10, temp % 10);
-
-                            list_push(http_request_list, r);
-                        }
+                        queue_sentilo_request(device_id, TEMP, temp);
                     }
 
                     if (hum_received)
                     {
                         // add a request to update sentilo info.
-                        struct http_request* r = NULL;
-                        r = (struct http_request*) memb_alloc(&http_request_mem);
-
-                        if (r != NULL)
-                        {
-                            r->target_type = SENTILO;
-                            r->target_id = device_id;
-                            r->data_type = HUM;
-                            sprintf(r->data, "%d.%d", hum / 10, hum % 10);
-
-                            list_push(http_request_list, r);
-                        }
+                        queue_sentilo_request(device_id, HUM, hum);
                     }
 
                     if (batt_received)
                     {
                         // add a request to update sentilo info.
-                        struct http_request* r = NULL;
-                        r = (struct http_request*) memb_alloc(&http_request_mem);
-
-                        if (r != NULL)
-                        {
-                            r->target_type = SENTILO;
-                            r->target_id = device_id;
-                            r->data_type = BATT;
-                            sprintf(r->data, "%d.%02d", batt / 1000, (batt/10) % 100);
-
-                            list_push(http_request_list, r);
-                        }
+                        queue_sentilo_request(device_id, BATT, batt);
                     }
 
                     if (light_received)
                     {
                         // add a request to update sentilo info.
-                        struct http_request* r = NULL;
-                        r = (struct http_request*) memb_alloc(&http_request_mem);
-
-                        if (r != NULL)
-                        {
-                            r->target_type = SENTILO;
-                            r->target_id = device_id;
-                            r->data_type = LIGHT;
-                            sprintf(r->data, "%d", light);
-
-                            list_push(http_request_list, r);
-                        }
+                        queue_sentilo_request(device_id, LIGHT, light);
                     }
 
                     // finished creating sentilo requests.
 
+#ifdef MQTT_BROKER_ADDR
+                    // publish the alerts raised or cleared by this packet.
+                    publish_mqtt_alert(device_id, "high_temp", high_temp_event,
+                        TEMP, temp);
+                    publish_mqtt_alert(device_id, "low_battery",
+                        low_battery_event, BATT, batt);
+                    publish_mqtt_alert(device_id, "low_pdr", low_pdr_event,
+                        PDR, pdr);
+                    publish_mqtt_alert(device_id, "sensor_error",
+                        sensor_error_event, OTHER, 0);
+
+                    for (int i = 0; i < NUMBER_OF_SENSORS; i++)
+                    {
+                        publish_mqtt_alert(device_id, "anomaly",
+                            anomaly_events[i], i, values[i]);
+                    }
+#endif
+
                     // preparing telegram request (if needed).
 
-                    char msg[MAX_DEVICE_STRING_DATA - MIN_TELEGRAM_MSG_SIZE] = "\0";
-                    char tmp[MAX_DEVICE_STRING_DATA - MIN_TELEGRAM_MSG_SIZE] = "\0";
+                    char f_anomaly_event = 0;
+
+                    for (int i = 0; i < NUMBER_OF_SENSORS; i++)
+                    {
+                        if (anomaly_events[i] != MOTE_ALERT_NONE)
+                        {
+                            f_anomaly_event = 1;
+                        }
+                    }
 
-                    if (f_sensor_error || f_high_temperature || f_low_battery ||
-                        current_device_info->f_low_pdr)
+                    if (sensor_error_event != MOTE_ALERT_NONE ||
+                        high_temp_event != MOTE_ALERT_NONE ||
+                        low_battery_event != MOTE_ALERT_NONE ||
+                        low_pdr_event != MOTE_ALERT_NONE ||
+                        f_anomaly_event)
                     {
                         // if some of these alerts were registered, then build
-                        // and send an alert through telegram.
-                        struct http_request* r = NULL;
-                        r = (struct http_request*) memb_alloc(&http_request_mem);
+                        // an alert and add it to the telegram digest.
+                        struct json_writer* w = telegram_digest_add(
+                            &telegram_digests[TELEGRAM_PRIVATE_CHAT]);
 
-                        if (r != NULL)
+                        if (w != NULL)
                         {
-                            r->target_type = TELEGRAM;
-
-                            snprintf(msg, MAX_DEVICE_STRING_DATA - MIN_TELEGRAM_MSG_SIZE -1,
-                                "Mote %d:\n",
-                                device_id);
+                            json_writer_escaped(w, "Mote ");
+                            json_writer_int(w, device_id);
+                            json_writer_escaped(w, ":\n");
 
-                            if (f_high_temperature)
+                            if (high_temp_event != MOTE_ALERT_NONE)
                             {
-                                snprintf(tmp, MAX_DEVICE_STRING_DATA - MIN_TELEGRAM_MSG_SIZE -1,
-                                    "- High temperature: %d.%d °C\n",
-                                    temp / 10,
-                                    temp % 10);
-
-                                strncat(msg, tmp, MAX_DEVICE_STRING_DATA - MIN_TELEGRAM_MSG_SIZE - strlen(msg) -1);
+                                json_writer_escaped(w,
+                                    high_temp_event == MOTE_ALERT_RAISED ?
+                                        "- High temperature: " :
+                                        "- Temperature back to normal: ");
+                                write_sensor_value(w, TEMP, temp);
+                                json_writer_escaped(w, " °C\n");
                             }
 
-                            if (f_low_battery)
+                            if (low_battery_event != MOTE_ALERT_NONE)
                             {
-                                snprintf(tmp, MAX_DEVICE_STRING_DATA - MIN_TELEGRAM_MSG_SIZE -1,
-                                    "- Low battery: %d.%02d V\n", batt / 1000, (batt/10) % 100);
-
-                                strncat(msg, tmp, MAX_DEVICE_STRING_DATA - MIN_TELEGRAM_MSG_SIZE - strlen(msg) -1);
+                                json_writer_escaped(w,
+                                    low_battery_event == MOTE_ALERT_RAISED ?
+                                        "- Low battery: " :
+                                        "- Battery back to normal: ");
+                                write_sensor_value(w, BATT, batt);
+                                json_writer_escaped(w, " V\n");
                             }
 
-                            if (current_device_info->f_low_pdr)
+                            if (low_pdr_event != MOTE_ALERT_NONE)
                             {
-                                snprintf(tmp, MAX_DEVICE_STRING_DATA - MIN_TELEGRAM_MSG_SIZE -1,
-                                    "- Low PDR: %d%%\n", pdr);
-
-                                strncat(msg, tmp, MAX_DEVICE_STRING_DATA - MIN_TELEGRAM_MSG_SIZE - strlen(msg) -1);
-
-                                // reset flag.
-                                current_device_info->f_low_pdr = 0;
+                                json_writer_escaped(w,
+                                    low_pdr_event == MOTE_ALERT_RAISED ?
+                                        "- Low PDR: " :
+                                        "- PDR back to normal: ");
+                                json_writer_int(w, pdr);
+                                json_writer_escaped(w, "%\n");
                             }
 
-                            if (f_sensor_error)
+                            for (int i = 0; i < NUMBER_OF_SENSORS; i++)
                             {
-                                snprintf(tmp, MAX_DEVICE_STRING_DATA - MIN_TELEGRAM_MSG_SIZE -1,
-                                    "- Sensor error");
-
-                                strncat(msg, tmp, MAX_DEVICE_STRING_DATA - MIN_TELEGRAM_MSG_SIZE - strlen(msg) -1);
+                                if (anomaly_events[i] != MOTE_ALERT_NONE)
+                                {
+                                    char data_type_string[8];
+
+                                    get_data_type_as_string(i, data_type_string);
+
+                                    json_writer_escaped(w,
+                                        anomaly_events[i] == MOTE_ALERT_RAISED ?
+                                            "- Unusual " : "- Usual ");
+                                    json_writer_escaped(w, data_type_string);
+                                    json_writer_escaped(w,
+                                        anomaly_events[i] == MOTE_ALERT_RAISED ?
+                                            ": " : " again: ");
+                                    write_sensor_value(w, i, values[i]);
+                                    json_writer_escaped(w, "\n");
+                                }
                             }
 
-                            snprintf(current_device_info->data, MAX_DEVICE_STRING_DATA -1,
-                                "{\"chat_id\":\"%s\",\"text\":\"%s\"}",
-                                TELEGRAM_PRIVATE_CHAT_ID,
-                                msg);
-
-                            r->data_type = OTHER;
-                            r->large_data = current_device_info->data;
-
-                            // add telegram request.
-                            list_push(http_request_list, r);
+                            if (sensor_error_event != MOTE_ALERT_NONE)
+                            {
+                                json_writer_escaped(w,
+                                    sensor_error_event == MOTE_ALERT_RAISED ?
+                                        "- Sensor error" :
+                                        "- Sensor working again");
+                            }
                         }
                     }
                     else
@@ -785,32 +2813,21 @@ static void tcpip_handler(void)
                         // if everything went ok and it is required to update data:
                         if (current_device_info->f_update_sensors_data_on_telegram)
                         {
-                            // add telegram request.
-                            struct http_request* r = NULL;
-                            r = (struct http_request*) memb_alloc(&http_request_mem);
+                            // add the summary to the telegram digest.
+                            struct json_writer* w = telegram_digest_add(
+                                &telegram_digests[TELEGRAM_PUBLIC_CHAT]);
 
-                            if (r != NULL)
+                            if (w != NULL)
                             {
-                                r->target_type = TELEGRAM;
-
-                                snprintf(msg, MAX_DEVICE_STRING_DATA - MIN_TELEGRAM_MSG_SIZE -1,
-                                    "Mote %d:\n- Temperature: %02d.%d °C\n- Humidity: %02d.%d%%\n- Light: %d%%",
-                                    device_id,
-                                    temp / 10,
-                                    temp % 10,
-                                    hum / 10,
-                                    hum % 10,
-                                    light);
-
-                                snprintf(current_device_info->data, MAX_DEVICE_STRING_DATA -1,
-                                    "{\"chat_id\":\"%s\",\"text\":\"%s\"}",
-                                    TELEGRAM_PUBLIC_CHAT_ID,
-                                    msg);
-
-                                r->data_type = OTHER;
-                                r->large_data = current_device_info->data;
-
-                                list_push(http_request_list, r);
+                                json_writer_escaped(w, "Mote ");
+                                json_writer_int(w, device_id);
+                                json_writer_escaped(w, ":\n- Temperature: ");
+                                write_sensor_value(w, TEMP, temp);
+                                json_writer_escaped(w, " °C\n- Humidity: ");
+                                write_sensor_value(w, HUM, hum);
+                                json_writer_escaped(w, "%\n- Light: ");
+                                write_sensor_value(w, LIGHT, light);
+                                json_writer_escaped(w, "%");
                             }
 
                             // reset flag.
@@ -871,14 +2888,444 @@ static void print_app_config()
     PRINTF("= APP config                                                =\n");
     PRINTF("=============================================================\n");
     PRINTF("Max number of motes to manage:  %d\n", NUMBER_OF_MOTES);
-    PRINTF("PDR Threshold:                  %d%% packets\n", MOTE_LOW_PDR_LIMIT);
-    PRINTF("Battery threshold:              %d mV\n", MOTE_LOW_BATTERY_LIMIT);
-    PRINTF("Temperature threshold:          %d °C\n", MOTE_HIGH_TEMP_LIMIT);
+    PRINTF("PDR Threshold:                  %ld%% packets\n", (long)low_pdr_limit);
+    PRINTF("Battery threshold:              %ld mV\n", (long)low_battery_limit);
+    PRINTF("Temperature threshold:          %ld °C\n", (long)high_temp_limit);
+    PRINTF("Anomaly threshold:              %ld.%ld standard deviations\n",
+        (long)anomaly_z_limit / 10, (long)anomaly_z_limit % 10);
     PRINTF("Using Sentilo URL:              '%s'\n", SENTILO_URL);
+#ifdef SENTILO_SECONDARY_URL
+    PRINTF("Using secondary Sentilo URL:    '%s'\n", SENTILO_SECONDARY_URL);
+#endif
+    PRINTF("Sentilo mode:                   %s\n",
+        get_sentilo_mode_as_string(sentilo_mode));
+#ifdef MQTT_BROKER_ADDR
+    PRINTF("Using MQTT broker:              '%s' port %d\n", MQTT_BROKER_ADDR,
+        MQTT_BROKER_PORT);
+#endif
+#ifdef COAP_COLLECTOR_ADDR
+    PRINTF("Using CoAP collector:           'coap://[%s]:%d/%s' (%s)\n",
+        COAP_COLLECTOR_ADDR, COAP_COLLECTOR_PORT, COAP_COLLECTOR_PATH,
+        COAP_CONFIRMABLE ? "CON" : "NON");
+#endif
     PRINTF("Using Telegram URL:             '%s'\n", TELEGRAM_API_URL);
+    PRINTF("Circuit failure threshold:      %ld requests\n",
+        (long)circuit_failure_threshold);
+    PRINTF("Request timeout bounds:         %ld-%ld ms\n",
+        (long)http_min_timeout, (long)http_max_timeout);
     PRINTF("=============================================================\n");
 }
 
+// room needed by the latest readings of a device and by the end of the
+// document.
+#define LATEST_READINGS_ROOM 96
+
+// writes the latest readings of a device, those of the sensors it never sent
+// are left out: {"id":1,"age":12,"temp":23.5,"hum":45.0,"light":30,"batt":3.30}
+static void write_latest_readings(struct json_writer* w,
+    const struct device_info* info)
+{
+    char data_type_string[8];
+
+    json_writer_object_start(w);
+    json_writer_key(w, "id");
+    json_writer_int(w, info->device_id);
+
+    if (info->seen)
+    {
+        // seconds since its last data packet.
+        json_writer_key(w, "age");
+        json_writer_int(w, (clock_time() - info->last_seen) / CLOCK_SECOND);
+
+        for (int i = 0; i < NUMBER_OF_SENSORS; i++)
+        {
+            if (info->stats[i].count == 0)
+            {
+                continue;
+            }
+
+            get_data_type_as_string(i, data_type_string);
+            json_writer_key(w, data_type_string);
+            write_sensor_value(w, i, info->stats[i].last);
+        }
+    }
+
+    json_writer_object_end(w);
+}
+
+// returns the value of a parameter of a query, name=value&..., or def if it
+// is not there.
+static long get_query_param(const char* query, const char* name, long def)
+{
+    size_t len = strlen(name);
+
+    while (*query != 0)
+    {
+        if (strncmp(query, name, len) == 0 && query[len] == '=')
+        {
+            return strtol(query + len + 1, NULL, 10);
+        }
+
+        query = strchr(query, '&');
+        if (query == NULL)
+        {
+            break;
+        }
+        query++;
+    }
+
+    return def;
+}
+
+// writes the samples of the history of a device received from 'from' to 'to'
+// seconds ago, oldest first, as [age,temp,hum,light,batt] with null for the
+// missing values. If they do not fit, "next" is the age of the first one left
+// out, to ask for the rest.
+static void write_history(struct json_writer* w,
+    const struct device_info* info, uint32_t from, uint32_t to)
+{
+    struct sample_history_cursor c;
+    struct sample_history_sample sample;
+    uint32_t now = clock_seconds();
+    // room needed by a sample and by the end of the document.
+    uint16_t min_room = 48;
+
+    json_writer_object_start(w);
+    json_writer_key(w, "id");
+    json_writer_int(w, info->device_id);
+    json_writer_key(w, "samples");
+    json_writer_array_start(w);
+
+    sample_history_cursor_init(&c, &info->history);
+
+    while (sample_history_next(&c, &sample))
+    {
+        uint32_t age = now - sample.time;
+
+        if (age > from || age < to)
+        {
+            continue;
+        }
+
+        if (w->end - w->len < min_room)
+        {
+            json_writer_array_end(w);
+            json_writer_key(w, "next");
+            json_writer_int(w, age);
+            json_writer_object_end(w);
+            return;
+        }
+
+        json_writer_array_start(w);
+        json_writer_int(w, age);
+
+        for (int i = 0; i < NUMBER_OF_SENSORS; i++)
+        {
+            if (sample.mask & (1 << i))
+            {
+                write_sensor_value(w, i, sample.values[i]);
+            }
+            else
+            {
+                json_writer_null(w);
+            }
+        }
+
+        json_writer_array_end(w);
+    }
+
+    json_writer_array_end(w);
+    json_writer_object_end(w);
+}
+
+// prints the samples of the history of a device received from 'from' to 'to'
+// seconds ago, one per line.
+static void print_history(const struct device_info* info, uint32_t from,
+    uint32_t to)
+{
+    struct sample_history_cursor c;
+    struct sample_history_sample sample;
+    uint32_t now = clock_seconds();
+    char data_type_string[8];
+
+    printf("History of mote %d\nage", info->device_id);
+    for (int i = 0; i < NUMBER_OF_SENSORS; i++)
+    {
+        get_data_type_as_string(i, data_type_string);
+        printf(" %s", data_type_string);
+    }
+    printf("\n");
+
+    sample_history_cursor_init(&c, &info->history);
+
+    while (sample_history_next(&c, &sample))
+    {
+        uint32_t age = now - sample.time;
+
+        if (age > from || age < to)
+        {
+            continue;
+        }
+
+        printf("%lu", (unsigned long)age);
+
+        for (int i = 0; i < NUMBER_OF_SENSORS; i++)
+        {
+            if (sample.mask & (1 << i))
+            {
+                printf(" %ld", (long)sample.values[i]);
+            }
+            else
+            {
+                printf(" -");
+            }
+        }
+
+        printf("\n");
+    }
+}
+
+// answers the requests of the local http server from the latest readings:
+// /motes for all of them and /motes/{id} for one, and from the history:
+// /motes/{id}/history?from={seconds ago}&to={seconds ago}.
+static int local_http_handler(const char* path, const char* query,
+    struct json_writer* w)
+{
+    if (strcmp(path, "/motes") == 0)
+    {
+        // the motes from this id on, as many as fit.
+        long from = get_query_param(query, "from", 1);
+
+        json_writer_object_start(w);
+        json_writer_key(w, "motes");
+        json_writer_array_start(w);
+
+        for (int i = from > 0 ? from - 1 : 0; i < NUMBER_OF_MOTES; i++)
+        {
+            if (w->end - w->len < LATEST_READINGS_ROOM)
+            {
+                json_writer_array_end(w);
+                json_writer_key(w, "next");
+                json_writer_int(w, device_info_list[i].device_id);
+                json_writer_object_end(w);
+
+                return 200;
+            }
+
+            write_latest_readings(w, &device_info_list[i]);
+        }
+
+        json_writer_array_end(w);
+        json_writer_object_end(w);
+
+        return 200;
+    }
+
+    if (strncmp(path, "/motes/", 7) == 0)
+    {
+        char* end;
+        long id = strtol(path + 7, &end, 10);
+
+        // the devices are numbered from 1, their info is found at once.
+        if (end == path + 7 || id < 1 || id > NUMBER_OF_MOTES)
+        {
+            return 404;
+        }
+
+        if (*end == 0)
+        {
+            write_latest_readings(w, &device_info_list[id - 1]);
+
+            return 200;
+        }
+
+        if (strcmp(end, "/history") == 0)
+        {
+            write_history(w, &device_info_list[id - 1],
+                get_query_param(query, "from", 3600),
+                get_query_param(query, "to", 0));
+
+            return 200;
+        }
+    }
+
+    return 404;
+}
+
+// history {id} [from] [to]: prints the samples of a mote received from 'from'
+// to 'to' seconds ago, the last hour by default.
+static void handle_history_command(const char* args)
+{
+    char* end;
+    long id = strtol(args, &end, 10);
+    long from = 3600;
+    long to = 0;
+
+    if (end == args || id < 1 || id > NUMBER_OF_MOTES)
+    {
+        printf("Unknown mote\n");
+        return;
+    }
+
+    if (*end != 0)
+    {
+        from = strtol(end, &end, 10);
+    }
+    if (*end != 0)
+    {
+        to = strtol(end, &end, 10);
+    }
+
+    print_history(&device_info_list[id - 1], from, to);
+}
+
+// prints the packets dropped by the ingress rate limits.
+static void print_ingress_stats()
+{
+    printf("Packets dropped at ingress: %lu\n", ingress_dropped);
+    printf("Probes echoed: %lu, dropped: %lu\n", probes_echoed,
+        probes_dropped);
+
+    for (int i = 0; i < NUMBER_OF_MOTES; i++)
+    {
+        printf("  mote %d: %u dropped%s\n", device_info_list[i].device_id,
+            device_info_list[i].ingress.dropped,
+            ingress_limit_cooling(&device_info_list[i].ingress) ?
+                ", cooling down" : "");
+    }
+}
+
+static void sentilo_mode_changed(const struct runtime_param* p)
+{
+    struct endpoint* e = &endpoint_list[SENTILO_SECONDARY];
+    struct http_request* r;
+
+    // the secondary endpoint only has its own queue in fan-out mode, drop the
+    // copies it still holds.
+    if (sentilo_mode != SENTILO_MODE_FANOUT)
+    {
+        while ((r = list_chop(e->request_list)) != NULL)
+        {
+            free_http_request(e, r);
+        }
+
+        // and the one being sent, which would be put back in the queue of the
+        // primary endpoint if it failed. Its result is still taken as the one
+        // of a probe.
+        if (e->current_request != NULL && e->current_request->fanout_copy)
+        {
+            free_http_request(e, e->current_request);
+            e->current_request = NULL;
+        }
+    }
+
+    PRINTF("Sentilo mode: %s\n", get_sentilo_mode_as_string(sentilo_mode));
+}
+
+static void http_timeout_bounds_changed(const struct runtime_param* p)
+{
+    for (int i = 0; i < NUMBER_OF_ENDPOINTS; i++)
+    {
+        endpoint_set_timeout(&endpoint_list[i], endpoint_list[i].timeout);
+    }
+}
+
+// the minimum timeout cannot be set over the maximum one, nor the other way.
+static int check_http_timeout_bounds(const struct runtime_param* p,
+    int32_t value)
+{
+    if (p->value == &http_min_timeout)
+    {
+        return value <= http_max_timeout;
+    }
+
+    return value >= http_min_timeout;
+}
+
+// the same for the first and the maximum interval between probes.
+static int check_probe_intervals(const struct runtime_param* p, int32_t value)
+{
+    if (p->value == &circuit_probe_interval)
+    {
+        return value <= circuit_probe_max_interval;
+    }
+
+    return value >= circuit_probe_interval;
+}
+
+static void telegram_digest_window_changed(const struct runtime_param* p)
+{
+    for (int i = 0; i < TELEGRAM_NUMBER_OF_CHATS; i++)
+    {
+        telegram_digests[i].window = MS_TO_CLOCK(telegram_digest_window);
+    }
+}
+
+static void aggregate_window_changed(const struct runtime_param* p)
+{
+    // the current window closes after the new time.
+    timer_set(&aggregate_timer, MS_TO_CLOCK(aggregate_window));
+}
+
+static void http_endpoint_interval_changed(const struct runtime_param* p)
+{
+    for (int i = 0; i < NUMBER_OF_ENDPOINTS; i++)
+    {
+        token_bucket_init(&endpoint_list[i].bucket, HTTP_ENDPOINT_BURST,
+            MS_TO_CLOCK(http_endpoint_interval));
+    }
+}
+
+static void http_request_period_changed(const struct runtime_param* p)
+{
+    etimer_set(&http_requests_timer, MS_TO_CLOCK(http_request_period));
+}
+
+// settings that can be changed through the serial line.
+static const struct runtime_param app_params[] =
+{
+    {"batt_limit", &low_battery_limit, 0, 5000, NULL},
+    {"pdr_limit", &low_pdr_limit, 0, 100, NULL},
+    {"temp_limit", &high_temp_limit, -40, 80, NULL},
+    {"anomaly_limit", &anomaly_z_limit, 0, 100, NULL},
+#ifdef SENTILO_SECONDARY_URL
+    {"sentilo_mode", &sentilo_mode, SENTILO_MODE_SINGLE, SENTILO_MODE_FANOUT,
+        sentilo_mode_changed},
+#else
+    {"sentilo_mode", &sentilo_mode, SENTILO_MODE_SINGLE, SENTILO_MODE_SINGLE,
+        sentilo_mode_changed},
+#endif
+    {"http_period", &http_request_period, 10, 60000,
+        http_request_period_changed},
+    {"http_min_timeout", &http_min_timeout, 10, 60000,
+        http_timeout_bounds_changed, check_http_timeout_bounds},
+    {"http_max_timeout", &http_max_timeout, 10, 600000,
+        http_timeout_bounds_changed, check_http_timeout_bounds},
+    {"http_attempts", &http_max_attempts, 1, 100, NULL},
+    {"temp_deadband", &upload_deadband[TEMP], 0, 1000, NULL},
+    {"hum_deadband", &upload_deadband[HUM], 0, 1000, NULL},
+    {"light_deadband", &upload_deadband[LIGHT], 0, 100, NULL},
+    {"batt_deadband", &upload_deadband[BATT], 0, 5000, NULL},
+    {"upload_max_age", &upload_max_age, 0, 3600000, NULL},
+    {"aggregate_window", &aggregate_window, 0, 3600000,
+        aggregate_window_changed},
+    {"http_interval", &http_endpoint_interval, 1, 60000,
+        http_endpoint_interval_changed},
+    {"device_quota", &http_device_quota, 1, 100, NULL},
+    {"circuit_failures", &circuit_failure_threshold, 1, 100, NULL},
+    {"probe_interval", &circuit_probe_interval, 100, 3600000, NULL,
+        check_probe_intervals},
+    {"probe_max_interval", &circuit_probe_max_interval, 100, 3600000, NULL,
+        check_probe_intervals},
+    {"failover_rtt", &failover_slow_rtt, 10, 60000, NULL},
+    {"digest_window", &telegram_digest_window, 0, 3600000,
+        telegram_digest_window_changed},
+#ifdef MQTT_BROKER_ADDR
+    {"mqtt_qos", &mqtt_data_qos, 0, 1, NULL},
+    {"mqtt_alert_qos", &mqtt_alert_qos, 0, 1, NULL},
+#endif
+};
+
 PROCESS_THREAD(border_router_and_udp_server_process, ev, data)
 {
     uip_ipaddr_t ipaddr;
@@ -934,27 +3381,98 @@ PROCESS_THREAD(border_router_and_udp_server_process, ev, data)
     // init ip64 module (ethernet).
     ip64_init();
 
-    print_app_config();
+    // serve the latest readings to the local network.
+    local_http_init(local_http_handler);
 
-    // init some vars.
-    http_data_received[0] = 0;
+    // init ingress rate limits.
+    ingress_limit_configure(INGRESS_BURST, INGRESS_INTERVAL, INGRESS_COOLDOWN);
+    ingress_dropped = 0;
+
+    // init the rate limit of the probe echoes.
+    token_bucket_init(&probe_echo_bucket, PROBE_ECHO_BURST,
+        PROBE_ECHO_INTERVAL);
+    probes_echoed = 0;
+    probes_dropped = 0;
 
     // init list of pdr (packet delivery ratio).
     for (int i = 0; i < NUMBER_OF_MOTES; i++)
     {
+        ingress_limit_init(&device_info_list[i].ingress);
         device_info_list[i].device_id = i+1;
         device_info_list[i].f_update_sensors_data_on_telegram = 0;
         device_info_list[i].packets_received = 0;
         device_info_list[i].packets_sent = 0;
+        device_info_list[i].seen = 0;
+        device_info_list[i].clock_offset_valid = 0;
+        device_info_list[i].last_transit = LATENCY_UNKNOWN;
+        init_latency_stats(&device_info_list[i].latency);
+        sample_history_init(&device_info_list[i].history);
+
+        for (int j = 0; j < NUMBER_OF_SENSORS; j++)
+        {
+            device_info_list[i].last_upload[j].valid = 0;
+            mote_window_init(&device_info_list[i].window[j]);
+            mote_stats_init(&device_info_list[i].stats[j]);
+            mote_alert_init(&device_info_list[i].anomaly_alert[j]);
+        }
+
+        mote_alert_init(&device_info_list[i].high_temp_alert);
+        mote_alert_init(&device_info_list[i].low_battery_alert);
+        mote_alert_init(&device_info_list[i].low_pdr_alert);
+        mote_alert_init(&device_info_list[i].sensor_error_alert);
     }
 
-    // init http requests list.
+    // the first aggregation window starts now.
+    timer_set(&aggregate_timer, MS_TO_CLOCK(aggregate_window));
+
+    // init http requests pool.
     memb_init(&http_request_mem);
-    list_init(http_request_list);
+
+    // init endpoints.
+    init_endpoint(&endpoint_list[SENTILO_PRIMARY], "Sentilo", SENTILO_URL,
+        SENTILO, SENTILO_TOKEN, MAX_SENTILO_REQUESTS);
+#ifdef SENTILO_SECONDARY_URL
+    init_endpoint(&endpoint_list[SENTILO_SECONDARY], "Sentilo (secondary)",
+        SENTILO_SECONDARY_URL, SENTILO, SENTILO_SECONDARY_TOKEN,
+        MAX_SENTILO_REQUESTS);
+#else
+    init_endpoint(&endpoint_list[SENTILO_SECONDARY], "Sentilo (secondary)",
+        NULL, SENTILO, NULL, 0);
+#endif
+    init_endpoint(&endpoint_list[TELEGRAM_API], "Telegram", TELEGRAM_API_URL,
+        TELEGRAM, NULL, MAX_TELEGRAM_REQUESTS);
+
+    // init telegram digests and rate limits.
+    telegram_digest_init(&telegram_digests[TELEGRAM_PRIVATE_CHAT],
+        TELEGRAM_PRIVATE_CHAT_ID, MS_TO_CLOCK(telegram_digest_window),
+        TELEGRAM_CHAT_BURST, TELEGRAM_CHAT_INTERVAL);
+    telegram_digest_init(&telegram_digests[TELEGRAM_PUBLIC_CHAT],
+        TELEGRAM_PUBLIC_CHAT_ID, MS_TO_CLOCK(telegram_digest_window),
+        TELEGRAM_CHAT_BURST, TELEGRAM_CHAT_INTERVAL);
+    token_bucket_init(&telegram_bot_bucket, TELEGRAM_BOT_BURST,
+        TELEGRAM_BOT_INTERVAL);
+
+    // start resolving the hosts of the endpoints.
+    uplink_dns_periodic();
+
+#ifdef MQTT_BROKER_ADDR
+    // the broker is connected to on the first tick of the requests timer.
+    uplink_mqtt_init(&border_router_and_udp_server_process, MQTT_BROKER_ADDR,
+        MQTT_BROKER_PORT, MQTT_CLIENT_ID, MQTT_USERNAME, MQTT_PASSWORD);
+#endif
+
+#ifdef COAP_COLLECTOR_ADDR
+    uplink_coap_init(COAP_COLLECTOR_ADDR, COAP_COLLECTOR_PORT,
+        COAP_COLLECTOR_PATH, COAP_CONFIRMABLE);
+#endif
+
+    // load the stored settings, if any.
+    runtime_params_init(app_params, sizeof(app_params) / sizeof(app_params[0]));
+
+    print_app_config();
 
     // init timers.
-    etimer_set(&http_requests_timer, HTTP_REQUEST_TIME);
-    etimer_set(&http_requests_timeout_timer, HTTP_REQUESTS_TIMEOUT_TIME);
+    etimer_set(&http_requests_timer, MS_TO_CLOCK(http_request_period));
 
     while (1)
     {
@@ -966,14 +3484,75 @@ PROCESS_THREAD(border_router_and_udp_server_process, ev, data)
             // handle the packet.
             tcpip_handler();
         }
+        else if (ev == resolv_event_found && data != NULL)
+        {
+            // a host of an endpoint may have been resolved.
+            uplink_dns_resolved((const char*)data);
+        }
+#ifdef MQTT_BROKER_ADDR
+        else if (ev == mqtt_update)
+        {
+            // the mqtt client is ready to take the next message.
+            uplink_mqtt_update();
+        }
+#endif
+        else if (ev == serial_line_event_message && data != NULL)
+        {
+            // a command to show the dropped packets, or to get or change the
+            // settings.
+            if (strcmp((const char*)data, "ingress") == 0)
+            {
+                print_ingress_stats();
+            }
+            else if (strcmp((const char*)data, "latency") == 0)
+            {
+                print_latency_stats();
+            }
+            else if (strcmp((const char*)data, "latency reset") == 0)
+            {
+                for (int i = 0; i < NUMBER_OF_MOTES; i++)
+                {
+                    init_latency_stats(&device_info_list[i].latency);
+                }
+            }
+            else if (strncmp((const char*)data, "history ", 8) == 0)
+            {
+                handle_history_command((const char*)data + 8);
+            }
+            else if (strncmp((const char*)data, "time ", 5) == 0)
+            {
+                // the wall clock, in seconds since the epoch.
+                wall_clock_offset = strtoul((const char*)data + 5, NULL, 10) -
+                    clock_seconds();
+                printf("Wall clock set\n");
+            }
+            else if (!runtime_params_handle_command((const char*)data))
+            {
+                printf("Unknown command\n");
+            }
+        }
 
         // if requests timer expired
         if (etimer_expired(&http_requests_timer))
         {
             // execute process for sending requests and reset the timer.
+            uplink_dns_periodic();
+#ifdef MQTT_BROKER_ADDR
+            uplink_mqtt_periodic();
+#endif
+#ifdef COAP_COLLECTOR_ADDR
+            uplink_coap_periodic();
+#endif
+            close_aggregate_windows();
+            queue_telegram_digests();
             send_http_requests();
             etimer_reset(&http_requests_timer);
         }
+        else if (ev == PROCESS_EVENT_POLL)
+        {
+            // previous request finished, send the next one.
+            send_http_requests();
+        }
     }
 
     PROCESS_END();
@@ -0,0 +1,116 @@
+/*
+ * Rate limit of the packets received from each mote.
+ */
+#include "ingress-limit.h"
+
+#include <string.h>
+
+#define DEBUG DEBUG_PRINT
+#include "net/ip/uip-debug.h"
+
+struct ingress_source
+{
+    uip_ipaddr_t addr;
+    uint8_t used;
+    clock_time_t last_seen;
+    struct ingress_limit limit;
+};
+
+static struct ingress_source source_list[INGRESS_LIMIT_SOURCES];
+
+static uint16_t limit_burst = 1;
+static clock_time_t limit_interval = CLOCK_SECOND;
+static clock_time_t limit_cooldown = 0;
+
+/*---------------------------------------------------------------------------*/
+void ingress_limit_configure(uint16_t burst, clock_time_t interval,
+    clock_time_t cooldown)
+{
+    limit_burst = burst;
+    limit_interval = interval;
+    limit_cooldown = cooldown;
+}
+/*---------------------------------------------------------------------------*/
+void ingress_limit_init(struct ingress_limit* l)
+{
+    token_bucket_init(&l->bucket, limit_burst, limit_interval);
+    l->cooling = 0;
+    l->dropped = 0;
+}
+/*---------------------------------------------------------------------------*/
+int ingress_limit_accept(struct ingress_limit* l)
+{
+    if (l->cooling)
+    {
+        if (!timer_expired(&l->cooldown_timer))
+        {
+            l->dropped++;
+            return 0;
+        }
+
+        // it starts again with the tokens gained meanwhile.
+        l->cooling = 0;
+    }
+
+    if (token_bucket_take(&l->bucket))
+    {
+        return 1;
+    }
+
+    l->dropped++;
+
+    if (limit_cooldown > 0)
+    {
+        l->cooling = 1;
+        timer_set(&l->cooldown_timer, limit_cooldown);
+        token_bucket_drain(&l->bucket);
+    }
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+int ingress_limit_cooling(struct ingress_limit* l)
+{
+    return l->cooling && !timer_expired(&l->cooldown_timer);
+}
+/*---------------------------------------------------------------------------*/
+struct ingress_limit* ingress_limit_source(const uip_ipaddr_t* addr)
+{
+    struct ingress_source* s;
+    struct ingress_source* oldest = &source_list[0];
+    clock_time_t now = clock_time();
+
+    for (s = source_list; s < source_list + INGRESS_LIMIT_SOURCES; s++)
+    {
+        if (s->used && uip_ipaddr_cmp(&s->addr, addr))
+        {
+            s->last_seen = now;
+            return &s->limit;
+        }
+
+        if (!s->used)
+        {
+            oldest = s;
+        }
+        else if (oldest->used &&
+            now - s->last_seen > now - oldest->last_seen)
+        {
+            oldest = s;
+        }
+    }
+
+    if (oldest->used)
+    {
+        PRINTF("Ingress table full, forgetting ");
+        PRINT6ADDR(&oldest->addr);
+        PRINTF("\n");
+    }
+
+    uip_ipaddr_copy(&oldest->addr, addr);
+    oldest->used = 1;
+    oldest->last_seen = now;
+    ingress_limit_init(&oldest->limit);
+
+    return &oldest->limit;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,46 @@
+/*
+ * Rate limit of the packets received from each mote. A mote that sends more
+ * than its burst is cooled down, its packets are dropped before being parsed
+ * until the cooldown ends, so a single faulty mote cannot take the router.
+ */
+#ifndef INGRESS_LIMIT_H
+#define INGRESS_LIMIT_H
+
+#include "contiki.h"
+#include "net/ip/uip.h"
+#include "token-bucket.h"
+
+// source addresses that are tracked. When a new one arrives and the table is
+// full, the one not heard from for the longest time is replaced.
+#ifndef INGRESS_LIMIT_SOURCES
+#define INGRESS_LIMIT_SOURCES 8
+#endif
+
+struct ingress_limit
+{
+    struct token_bucket bucket;
+    // packets are dropped while it is cooling down.
+    uint8_t cooling;
+    struct timer cooldown_timer;
+    // packets dropped since it was set up.
+    uint16_t dropped;
+};
+
+// sets the rate allowed (a burst of packets and then one each interval) and
+// the time a source is cooled down after exceeding it.
+void ingress_limit_configure(uint16_t burst, clock_time_t interval,
+    clock_time_t cooldown);
+
+void ingress_limit_init(struct ingress_limit* l);
+
+// counts a packet, returns 0 if it has to be dropped.
+int ingress_limit_accept(struct ingress_limit* l);
+
+// returns 1 while its packets are being dropped.
+int ingress_limit_cooling(struct ingress_limit* l);
+
+// returns the limit of a source address, taking a new entry for it if it is
+// not tracked yet.
+struct ingress_limit* ingress_limit_source(const uip_ipaddr_t* addr);
+
+#endif /* INGRESS_LIMIT_H */
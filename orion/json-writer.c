@@ -0,0 +1,422 @@
+/*
+ * Bounded writer that builds text, URLs and JSON documents in one pass directly
+ * into a caller supplied buffer.
+ */
+#include "json-writer.h"
+
+#include <string.h>
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+/*---------------------------------------------------------------------------*/
+// appends n bytes if all of them fit.
+static int put(struct json_writer* w, const char* data, size_t n)
+{
+    if (w->overflow || w->len + n > w->end)
+    {
+        w->overflow = 1;
+        return 0;
+    }
+
+    memcpy(w->buf + w->len, data, n);
+    w->len += n;
+    w->buf[w->len] = 0;
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+// appends a closing character in the space reserved for it.
+static void put_closing(struct json_writer* w, char c)
+{
+    w->end++;
+    w->buf[w->len++] = c;
+    w->buf[w->len] = 0;
+}
+/*---------------------------------------------------------------------------*/
+// remembers where the value being written starts.
+static void set_mark(struct json_writer* w)
+{
+    w->mark = w->len;
+    w->mark_empty = w->empty;
+    w->marked = 1;
+}
+/*---------------------------------------------------------------------------*/
+// adds the separator needed before a new value of an array.
+static void begin_value(struct json_writer* w)
+{
+    uint8_t bit;
+
+    if (w->in_string)
+    {
+        return;
+    }
+
+    // after a key the value starts before it.
+    if (w->key_pending)
+    {
+        w->key_pending = 0;
+    }
+    else if (!w->overflow)
+    {
+        set_mark(w);
+    }
+    else
+    {
+        w->marked = 0;
+    }
+
+    if (w->depth == 0)
+    {
+        return;
+    }
+
+    bit = 1 << (w->depth - 1);
+
+    if (w->in_array & bit)
+    {
+        if (!(w->empty & bit))
+        {
+            put(w, ",", 1);
+        }
+
+        w->empty &= ~bit;
+    }
+}
+/*---------------------------------------------------------------------------*/
+// takes back the value that was being written, with its separator or key, if
+// it did not fit.
+static void end_value(struct json_writer* w)
+{
+    if (w->overflow && w->marked)
+    {
+        w->len = w->mark;
+        w->buf[w->len] = 0;
+        w->empty = w->mark_empty;
+    }
+
+    w->marked = 0;
+}
+/*---------------------------------------------------------------------------*/
+static void open_container(struct json_writer* w, char c, int array)
+{
+    uint8_t bit;
+
+    begin_value(w);
+
+    if (w->overflow || w->depth >= JSON_WRITER_MAX_DEPTH ||
+        w->end - w->len < 2)
+    {
+        // remember it so its end does not close the parent.
+        w->overflow = 1;
+        w->skipped++;
+        end_value(w);
+        return;
+    }
+
+    put(w, &c, 1);
+    w->end--;
+    end_value(w);
+
+    bit = 1 << w->depth;
+    w->depth++;
+    w->empty |= bit;
+
+    if (array)
+    {
+        w->in_array |= bit;
+    }
+    else
+    {
+        w->in_array &= ~bit;
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void close_container(struct json_writer* w, char c)
+{
+    if (w->skipped > 0)
+    {
+        w->skipped--;
+        return;
+    }
+
+    if (w->depth == 0)
+    {
+        return;
+    }
+
+    w->depth--;
+    put_closing(w, c);
+}
+/*---------------------------------------------------------------------------*/
+void json_writer_init(struct json_writer* w, char* buf, size_t size)
+{
+    w->buf = buf;
+    w->len = 0;
+    w->end = size > 0 ? size - 1 : 0;
+    w->depth = 0;
+    w->in_array = 0;
+    w->empty = 0;
+    w->in_string = 0;
+    w->skipped = 0;
+    w->overflow = size == 0;
+    w->marked = 0;
+    w->key_pending = 0;
+
+    if (size > 0)
+    {
+        buf[0] = 0;
+    }
+}
+/*---------------------------------------------------------------------------*/
+void json_writer_raw(struct json_writer* w, const char* str)
+{
+    put(w, str, strlen(str));
+}
+/*---------------------------------------------------------------------------*/
+void json_writer_int(struct json_writer* w, long value)
+{
+    char digits[22];
+    unsigned long v;
+    int i = sizeof(digits);
+
+    begin_value(w);
+
+    v = value < 0 ? -(unsigned long)value : (unsigned long)value;
+
+    do
+    {
+        digits[--i] = '0' + v % 10;
+        v /= 10;
+    }
+    while (v > 0);
+
+    if (value < 0)
+    {
+        digits[--i] = '-';
+    }
+
+    put(w, digits + i, sizeof(digits) - i);
+    end_value(w);
+}
+/*---------------------------------------------------------------------------*/
+void json_writer_null(struct json_writer* w)
+{
+    begin_value(w);
+    put(w, "null", 4);
+    end_value(w);
+}
+/*---------------------------------------------------------------------------*/
+void json_writer_fixed(struct json_writer* w, long value, uint8_t decimals)
+{
+    char digits[24];
+    unsigned long v;
+    int i = sizeof(digits);
+    int n = 0;
+
+    begin_value(w);
+
+    v = value < 0 ? -(unsigned long)value : (unsigned long)value;
+
+    // the decimals, with leading zeros, then the integer part.
+    do
+    {
+        if (n == decimals && decimals > 0)
+        {
+            digits[--i] = '.';
+        }
+
+        digits[--i] = '0' + v % 10;
+        v /= 10;
+        n++;
+    }
+    while ((v > 0 || n <= decimals) && i > 1);
+
+    if (value < 0)
+    {
+        digits[--i] = '-';
+    }
+
+    put(w, digits + i, sizeof(digits) - i);
+    end_value(w);
+}
+/*---------------------------------------------------------------------------*/
+void json_writer_escaped(struct json_writer* w, const char* str)
+{
+    char esc[6];
+    size_t n;
+    unsigned char c;
+
+    while (*str != 0 && !w->overflow)
+    {
+        c = (unsigned char)*str;
+        n = 1;
+
+        if (c == '"' || c == '\\')
+        {
+            esc[0] = '\\';
+            esc[1] = c;
+            put(w, esc, 2);
+        }
+        else if (c == '\n')
+        {
+            put(w, "\\n", 2);
+        }
+        else if (c == '\r')
+        {
+            put(w, "\\r", 2);
+        }
+        else if (c == '\t')
+        {
+            put(w, "\\t", 2);
+        }
+        else if (c < 0x20)
+        {
+            esc[0] = '\\';
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex_digits[c >> 4];
+            esc[5] = hex_digits[c & 0x0f];
+            put(w, esc, 6);
+        }
+        else
+        {
+            // keep multibyte UTF-8 characters whole.
+            if (c >= 0xf0)
+            {
+                n = 4;
+            }
+            else if (c >= 0xe0)
+            {
+                n = 3;
+            }
+            else if (c >= 0xc0)
+            {
+                n = 2;
+            }
+
+            n = strnlen(str, n);
+            put(w, str, n);
+        }
+
+        str += n;
+    }
+}
+/*---------------------------------------------------------------------------*/
+void json_writer_url_escaped(struct json_writer* w, const char* str)
+{
+    char esc[3];
+    unsigned char c;
+
+    for (; *str != 0 && !w->overflow; str++)
+    {
+        c = (unsigned char)*str;
+
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' ||
+            c == '~')
+        {
+            put(w, str, 1);
+        }
+        else
+        {
+            esc[0] = '%';
+            esc[1] = hex_digits[c >> 4];
+            esc[2] = hex_digits[c & 0x0f];
+            put(w, esc, 3);
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+void json_writer_object_start(struct json_writer* w)
+{
+    open_container(w, '{', 0);
+}
+/*---------------------------------------------------------------------------*/
+void json_writer_object_end(struct json_writer* w)
+{
+    close_container(w, '}');
+}
+/*---------------------------------------------------------------------------*/
+void json_writer_array_start(struct json_writer* w)
+{
+    open_container(w, '[', 1);
+}
+/*---------------------------------------------------------------------------*/
+void json_writer_array_end(struct json_writer* w)
+{
+    close_container(w, ']');
+}
+/*---------------------------------------------------------------------------*/
+void json_writer_key(struct json_writer* w, const char* key)
+{
+    uint8_t bit;
+    int comma;
+
+    if (w->depth == 0)
+    {
+        return;
+    }
+
+    bit = 1 << (w->depth - 1);
+    comma = !(w->empty & bit);
+
+    // the key is written whole or not at all.
+    if (w->overflow || w->len + comma + strlen(key) + 3 > w->end)
+    {
+        w->overflow = 1;
+        return;
+    }
+
+    // its value takes it back if it does not fit.
+    set_mark(w);
+    w->key_pending = 1;
+
+    if (comma)
+    {
+        put(w, ",", 1);
+    }
+
+    w->empty &= ~bit;
+
+    put(w, "\"", 1);
+    json_writer_raw(w, key);
+    put(w, "\":", 2);
+}
+/*---------------------------------------------------------------------------*/
+void json_writer_string(struct json_writer* w, const char* str)
+{
+    json_writer_string_start(w);
+    json_writer_escaped(w, str);
+    json_writer_string_end(w);
+}
+/*---------------------------------------------------------------------------*/
+void json_writer_string_start(struct json_writer* w)
+{
+    begin_value(w);
+
+    if (w->overflow || w->end - w->len < 2)
+    {
+        w->overflow = 1;
+        end_value(w);
+        return;
+    }
+
+    put(w, "\"", 1);
+    w->end--;
+    w->in_string = 1;
+    // its content is cut instead.
+    end_value(w);
+}
+/*---------------------------------------------------------------------------*/
+void json_writer_string_end(struct json_writer* w)
+{
+    if (!w->in_string)
+    {
+        return;
+    }
+
+    w->in_string = 0;
+    put_closing(w, '"');
+}
+/*---------------------------------------------------------------------------*/
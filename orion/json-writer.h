@@ -0,0 +1,81 @@
+/*
+ * Bounded writer that builds text, URLs and JSON documents in one pass directly
+ * into a caller supplied buffer, without dynamic memory. Each append takes time
+ * proportional to what is appended and the buffer is always NUL terminated.
+ *
+ * Opening an object, array or string reserves the space of its closing
+ * character, and a value that does not fit is taken back with its separator
+ * and its key, so a document is always valid when closed even if some content
+ * did not fit (strings are cut instead). Content that does not fit is dropped
+ * and the overflow flag is set.
+ */
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// maximum nesting of objects and arrays.
+#define JSON_WRITER_MAX_DEPTH 8
+
+struct json_writer
+{
+    char* buf;
+    uint16_t len;
+    // bytes that can be used by the content, not counting the ones reserved for
+    // closing characters nor the final NUL.
+    uint16_t end;
+    uint8_t depth;
+    // one bit for each nesting level.
+    uint8_t in_array;
+    uint8_t empty;
+    uint8_t in_string;
+    // containers that could not be opened.
+    uint8_t skipped;
+    uint8_t overflow;
+    // start of the value being written, before its separator or its key, and
+    // the empty bits there, to take it back if it does not fit.
+    uint16_t mark;
+    uint8_t mark_empty;
+    uint8_t marked;
+    // a key was written, its value starts at the mark.
+    uint8_t key_pending;
+};
+
+void json_writer_init(struct json_writer* w, char* buf, size_t size);
+
+// appends text as is.
+void json_writer_raw(struct json_writer* w, const char* str);
+
+void json_writer_int(struct json_writer* w, long value);
+
+void json_writer_null(struct json_writer* w);
+
+// appends a value scaled by 10^decimals, e.g. 235 with 1 decimal is "23.5".
+void json_writer_fixed(struct json_writer* w, long value, uint8_t decimals);
+
+// appends text escaped for a JSON string, cutting it on a character boundary if
+// it does not fit.
+void json_writer_escaped(struct json_writer* w, const char* str);
+
+// appends text percent-encoded for a URL.
+void json_writer_url_escaped(struct json_writer* w, const char* str);
+
+void json_writer_object_start(struct json_writer* w);
+void json_writer_object_end(struct json_writer* w);
+void json_writer_array_start(struct json_writer* w);
+void json_writer_array_end(struct json_writer* w);
+
+// appends the key of the next member of an object, as is.
+void json_writer_key(struct json_writer* w, const char* key);
+
+// a string value can be written at once or in several parts between its start
+// and end.
+void json_writer_string(struct json_writer* w, const char* str);
+void json_writer_string_start(struct json_writer* w);
+void json_writer_string_end(struct json_writer* w);
+
+#define json_writer_length(w) ((w)->len)
+#define json_writer_overflow(w) ((w)->overflow)
+
+#endif /* JSON_WRITER_H */
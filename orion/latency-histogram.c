@@ -0,0 +1,74 @@
+/*
+ * Histogram of latencies in milliseconds.
+ */
+#include "latency-histogram.h"
+
+/*---------------------------------------------------------------------------*/
+void latency_histogram_init(struct latency_histogram* h)
+{
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+    {
+        h->buckets[i] = 0;
+    }
+
+    h->count = 0;
+    h->max = 0;
+}
+/*---------------------------------------------------------------------------*/
+void latency_histogram_add(struct latency_histogram* h, uint32_t ms)
+{
+    uint8_t i = 0;
+
+    // the counters are halved when one is full, keeping the proportions.
+    if (h->count == UINT16_MAX)
+    {
+        h->count = 0;
+
+        for (int j = 0; j < LATENCY_HISTOGRAM_BUCKETS; j++)
+        {
+            h->buckets[j] /= 2;
+            h->count += h->buckets[j];
+        }
+    }
+
+    if (ms > h->max)
+    {
+        h->max = ms;
+    }
+
+    while (ms > 0 && i < LATENCY_HISTOGRAM_BUCKETS - 1)
+    {
+        ms >>= 1;
+        i++;
+    }
+
+    h->buckets[i]++;
+    h->count++;
+}
+/*---------------------------------------------------------------------------*/
+uint32_t latency_histogram_percentile(const struct latency_histogram* h,
+    uint8_t percentile)
+{
+    uint32_t target = ((uint32_t)h->count * percentile + 99) / 100;
+    uint32_t seen = 0;
+
+    if (h->count == 0)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS - 1; i++)
+    {
+        seen += h->buckets[i];
+
+        if (seen >= target)
+        {
+            // the upper bound of the bucket, but never over the max seen.
+            uint32_t bound = i == 0 ? 0 : (1UL << i) - 1;
+            return bound < h->max ? bound : h->max;
+        }
+    }
+
+    return h->max;
+}
+/*---------------------------------------------------------------------------*/
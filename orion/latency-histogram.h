@@ -0,0 +1,30 @@
+/*
+ * Histogram of latencies in milliseconds, with a bucket for each power of two,
+ * so it takes constant memory whatever the range of the latencies.
+ */
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+// bucket i counts the latencies from 2^(i-1) to 2^i - 1 ms (0 for bucket 0),
+// the last one counts all the ones from 2^14 ms (about 16 seconds) on.
+#define LATENCY_HISTOGRAM_BUCKETS 16
+
+struct latency_histogram
+{
+    uint16_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+    uint16_t count;
+    uint32_t max;
+};
+
+void latency_histogram_init(struct latency_histogram* h);
+
+void latency_histogram_add(struct latency_histogram* h, uint32_t ms);
+
+// upper bound of the percentile (0-100) of the latencies added, 0 if there
+// are none.
+uint32_t latency_histogram_percentile(const struct latency_histogram* h,
+    uint8_t percentile);
+
+#endif /* LATENCY_HISTOGRAM_H */
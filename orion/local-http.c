@@ -0,0 +1,254 @@
+/*
+ * Small read-only HTTP server for the local network.
+ */
+#include "local-http.h"
+#include "tcp-socket.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if LOCAL_HTTP_CONF_IP64
+#include "ip64-special-ports.h"
+#endif
+
+#define DEBUG DEBUG_PRINT
+#include "net/ip/uip-debug.h"
+
+// room for the status line and the headers of a response.
+#define HEADER_LEN 96
+
+struct connection
+{
+    struct tcp_socket s;
+    // the request line, the rest of the request is ignored.
+    uint8_t inbuf[LOCAL_HTTP_PATH_LEN + 16];
+    uint8_t outbuf[HEADER_LEN + LOCAL_HTTP_BODY_SIZE];
+    // the response has been sent, the connection is being closed.
+    uint8_t answered;
+};
+
+static struct connection connection_list[LOCAL_HTTP_CONNECTIONS];
+static local_http_handler_t request_handler;
+
+// responses are written one at a time, and copied to the connection.
+static char body[LOCAL_HTTP_BODY_SIZE];
+
+/*---------------------------------------------------------------------------*/
+static const char* get_reason(int status)
+{
+    switch (status)
+    {
+        case 200:
+            return "OK";
+        case 400:
+            return "Bad Request";
+        case 404:
+            return "Not Found";
+        case 405:
+            return "Method Not Allowed";
+        default:
+            return "Internal Server Error";
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void respond(struct connection* c, int status, struct json_writer* w)
+{
+    char header[HEADER_LEN];
+    uint16_t len = json_writer_length(w);
+
+    snprintf(header, sizeof(header), "HTTP/1.0 %d %s\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: %u\r\n"
+        "Connection: close\r\n\r\n", status, get_reason(status), len);
+
+    tcp_socket_send_str(&c->s, header);
+    tcp_socket_send(&c->s, (const uint8_t*)body, len);
+    tcp_socket_close(&c->s);
+
+    c->answered = 1;
+}
+/*---------------------------------------------------------------------------*/
+static void respond_error(struct connection* c, int status)
+{
+    struct json_writer w;
+
+    json_writer_init(&w, body, sizeof(body));
+    json_writer_object_start(&w);
+    json_writer_key(&w, "error");
+    json_writer_string(&w, get_reason(status));
+    json_writer_object_end(&w);
+
+    respond(c, status, &w);
+}
+/*---------------------------------------------------------------------------*/
+// handles the request line, "GET /path?query HTTP/1.1".
+static void handle_request(struct connection* c, char* line)
+{
+    struct json_writer w;
+    char* path;
+    char* query = "";
+    char* end;
+    int status;
+
+    if (strncmp(line, "GET ", 4) != 0)
+    {
+        respond_error(c, 405);
+        return;
+    }
+
+    path = line + 4;
+    end = strpbrk(path, " ?");
+
+    if (end == NULL || *path != '/')
+    {
+        respond_error(c, 400);
+        return;
+    }
+
+    if (*end == '?')
+    {
+        *end = 0;
+        query = end + 1;
+        end = strchr(query, ' ');
+
+        if (end == NULL)
+        {
+            respond_error(c, 400);
+            return;
+        }
+    }
+
+    *end = 0;
+
+    json_writer_init(&w, body, sizeof(body));
+    status = request_handler(path, query, &w);
+
+    // do not serve a body with some content left out as if it was complete.
+    if (status == 200 && json_writer_overflow(&w))
+    {
+        PRINTF("Response to %s does not fit, raise LOCAL_HTTP_BODY_SIZE.\n",
+            path);
+        status = 500;
+    }
+
+    if (status != 200)
+    {
+        respond_error(c, status);
+        return;
+    }
+
+    respond(c, status, &w);
+}
+/*---------------------------------------------------------------------------*/
+static int input(struct tcp_socket* s, void* ptr, const uint8_t* data,
+    int len)
+{
+    struct connection* c = ptr;
+    char line[sizeof(c->inbuf) + 1];
+    const uint8_t* eol;
+    int line_len;
+
+    if (c->answered)
+    {
+        return 0;
+    }
+
+    eol = memchr(data, '\n', len);
+
+    if (eol == NULL)
+    {
+        if (len >= (int)sizeof(c->inbuf))
+        {
+            // the request line does not fit, so neither does its path.
+            respond_error(c, 404);
+            return 0;
+        }
+
+        // keep it until the line is complete.
+        return len;
+    }
+
+    line_len = eol - data;
+    if (line_len > 0 && data[line_len - 1] == '\r')
+    {
+        line_len--;
+    }
+
+    memcpy(line, data, line_len);
+    line[line_len] = 0;
+
+    handle_request(c, line);
+
+    return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void event(struct tcp_socket* s, void* ptr, tcp_socket_event_t ev)
+{
+    struct connection* c = ptr;
+
+    if (ev == TCP_SOCKET_CONNECTED)
+    {
+        c->answered = 0;
+    }
+}
+/*---------------------------------------------------------------------------*/
+void local_http_init(local_http_handler_t handler)
+{
+    request_handler = handler;
+
+    for (int i = 0; i < LOCAL_HTTP_CONNECTIONS; i++)
+    {
+        struct connection* c = &connection_list[i];
+
+        c->answered = 0;
+        tcp_socket_register(&c->s, c, c->inbuf, sizeof(c->inbuf), c->outbuf,
+            sizeof(c->outbuf), input, event);
+        tcp_socket_listen(&c->s, LOCAL_HTTP_PORT);
+    }
+
+    PRINTF("Local HTTP server listening on port %u.\n", LOCAL_HTTP_PORT);
+}
+/*---------------------------------------------------------------------------*/
+#if LOCAL_HTTP_CONF_IP64
+// connections to LOCAL_HTTP_PORT of the IPv4 address of the router are
+// forwarded to its IPv6 global address, and their answers keep the port.
+int ip64_special_ports_incoming_is_special(uint16_t port)
+{
+    return port == LOCAL_HTTP_PORT;
+}
+/*---------------------------------------------------------------------------*/
+int ip64_special_ports_translate_incoming(uint16_t incoming_port,
+    uip_ip6addr_t* newaddr, uint16_t* newport)
+{
+    uip_ds6_addr_t* addr = uip_ds6_get_global(ADDR_PREFERRED);
+
+    if (incoming_port != LOCAL_HTTP_PORT || addr == NULL)
+    {
+        return 0;
+    }
+
+    uip_ipaddr_copy(newaddr, &addr->ipaddr);
+    *newport = LOCAL_HTTP_PORT;
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+int ip64_special_ports_outgoing_is_special(uint16_t port)
+{
+    return port == LOCAL_HTTP_PORT;
+}
+/*---------------------------------------------------------------------------*/
+int ip64_special_ports_translate_outgoing(uint16_t outgoing_port,
+    const uip_ip6addr_t* ip6addr, uint16_t* newport)
+{
+    if (outgoing_port != LOCAL_HTTP_PORT)
+    {
+        return 0;
+    }
+
+    *newport = LOCAL_HTTP_PORT;
+
+    return 1;
+}
+#endif /* LOCAL_HTTP_CONF_IP64 */
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,40 @@
+/*
+ * Small read-only HTTP server for the local network. Each GET request is
+ * answered at once by a handler that writes a JSON body, from memory and
+ * without touching the mesh. Everything is statically allocated.
+ */
+#ifndef LOCAL_HTTP_H
+#define LOCAL_HTTP_H
+
+#include "contiki.h"
+#include "json-writer.h"
+
+#ifndef LOCAL_HTTP_PORT
+#define LOCAL_HTTP_PORT 80
+#endif
+
+// connections served at the same time.
+#ifndef LOCAL_HTTP_CONNECTIONS
+#define LOCAL_HTTP_CONNECTIONS 2
+#endif
+
+// max size of the body of a response.
+#ifndef LOCAL_HTTP_BODY_SIZE
+#define LOCAL_HTTP_BODY_SIZE 512
+#endif
+
+// max length of the path and query of a request, longer ones are not found.
+#define LOCAL_HTTP_PATH_LEN 48
+
+// writes the body of the response to a GET of a path and returns its status
+// code, e.g. 200 or 404. query is the part after '?', empty if there is none.
+// A body that does not fit in LOCAL_HTTP_BODY_SIZE is answered with 500.
+typedef int (*local_http_handler_t)(const char* path, const char* query,
+    struct json_writer* w);
+
+// starts listening on LOCAL_HTTP_PORT. With LOCAL_HTTP_CONF_IP64 the port is
+// also forwarded by ip64 from its IPv4 address, so hosts of the ethernet side
+// can reach it.
+void local_http_init(local_http_handler_t handler);
+
+#endif /* LOCAL_HTTP_H */
@@ -0,0 +1,159 @@
+/*
+ * Running statistics of the sensor readings of a mote and alerts with
+ * hysteresis built on them.
+ */
+#include "mote-stats.h"
+
+#define TO_FIXED(v) ((int32_t)(v) * (1 << MOTE_STATS_FRACTION_BITS))
+#define FROM_FIXED(v) ((v) / (1 << MOTE_STATS_FRACTION_BITS))
+
+/*---------------------------------------------------------------------------*/
+void mote_stats_init(struct mote_stats* st)
+{
+    st->count = 0;
+    st->last = 0;
+    st->min = 0;
+    st->max = 0;
+    st->ewma = 0;
+    st->mean = 0;
+    st->variance = 0;
+}
+/*---------------------------------------------------------------------------*/
+void mote_stats_update(struct mote_stats* st, int32_t value)
+{
+    int32_t x = TO_FIXED(value);
+    int32_t delta;
+    int64_t variance;
+    int n;
+
+    st->last = value;
+
+    if (st->count == 0)
+    {
+        st->count = 1;
+        st->min = value;
+        st->max = value;
+        st->ewma = x;
+        st->mean = x;
+        st->variance = 0;
+
+        return;
+    }
+
+    if (st->count < MOTE_STATS_WINDOW)
+    {
+        st->count++;
+    }
+
+    if (value < st->min)
+    {
+        st->min = value;
+    }
+
+    if (value > st->max)
+    {
+        st->max = value;
+    }
+
+    st->ewma += (x - st->ewma) / (1 << MOTE_STATS_EWMA_SHIFT);
+
+    // with n = count this is Welford's update of the mean and the population
+    // variance: mean += delta / n, var = (1 - 1/n) * (var + delta^2 / n).
+    n = st->count;
+    delta = x - st->mean;
+    st->mean += delta / n;
+
+    variance = st->variance + ((int64_t)delta * delta) / n;
+    st->variance = variance - variance / n;
+}
+/*---------------------------------------------------------------------------*/
+int32_t mote_stats_mean(const struct mote_stats* st)
+{
+    return FROM_FIXED(st->mean);
+}
+/*---------------------------------------------------------------------------*/
+int32_t mote_stats_ewma(const struct mote_stats* st)
+{
+    return FROM_FIXED(st->ewma);
+}
+/*---------------------------------------------------------------------------*/
+int mote_stats_is_outlier(const struct mote_stats* st, int32_t value,
+    int z_limit)
+{
+    int64_t delta;
+
+    if (z_limit <= 0 || st->count < MOTE_STATS_MIN_SAMPLES)
+    {
+        return 0;
+    }
+
+    // |x - mean| > (z / 10) * stddev, compared squared to avoid the root.
+    delta = TO_FIXED(value) - st->mean;
+
+    return delta * delta * 100 > (int64_t)z_limit * z_limit * st->variance;
+}
+/*---------------------------------------------------------------------------*/
+void mote_window_init(struct mote_window* w)
+{
+    w->count = 0;
+    w->min = 0;
+    w->max = 0;
+    w->sum = 0;
+}
+/*---------------------------------------------------------------------------*/
+void mote_window_update(struct mote_window* w, int32_t value)
+{
+    if (w->count == 0 || value < w->min)
+    {
+        w->min = value;
+    }
+
+    if (w->count == 0 || value > w->max)
+    {
+        w->max = value;
+    }
+
+    w->sum += value;
+    w->count++;
+}
+/*---------------------------------------------------------------------------*/
+int32_t mote_window_mean(const struct mote_window* w)
+{
+    if (w->count == 0)
+    {
+        return 0;
+    }
+
+    if (w->sum < 0)
+    {
+        return (w->sum - w->count / 2) / w->count;
+    }
+
+    return (w->sum + w->count / 2) / w->count;
+}
+/*---------------------------------------------------------------------------*/
+void mote_alert_init(struct mote_alert* a)
+{
+    a->active = 0;
+}
+/*---------------------------------------------------------------------------*/
+mote_alert_event_t mote_alert_update(struct mote_alert* a, int enter,
+    int leave)
+{
+    if (!a->active && enter)
+    {
+        a->active = 1;
+
+        return MOTE_ALERT_RAISED;
+    }
+
+    if (a->active && leave)
+    {
+        a->active = 0;
+
+        return MOTE_ALERT_CLEARED;
+    }
+
+    return MOTE_ALERT_NONE;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,93 @@
+/*
+ * Running statistics of the sensor readings of a mote and alerts with
+ * hysteresis built on them. Everything is computed incrementally, in constant
+ * time and memory for each sensor.
+ */
+#ifndef MOTE_STATS_H
+#define MOTE_STATS_H
+
+#include <stdint.h>
+
+// fractional bits of the fixed point mean and ewma values.
+#define MOTE_STATS_FRACTION_BITS 4
+
+// the ewma weights each new sample with 1 / 2^MOTE_STATS_EWMA_SHIFT.
+#ifndef MOTE_STATS_EWMA_SHIFT
+#define MOTE_STATS_EWMA_SHIFT 3
+#endif
+
+// mean and variance are computed with Welford's method over the first samples
+// and, once this number of samples is reached, each new sample is weighted with
+// 1 / MOTE_STATS_WINDOW so the old ones fade out.
+#ifndef MOTE_STATS_WINDOW
+#define MOTE_STATS_WINDOW 32
+#endif
+
+// samples needed before using the variance for detecting anomalies.
+#ifndef MOTE_STATS_MIN_SAMPLES
+#define MOTE_STATS_MIN_SAMPLES 10
+#endif
+
+struct mote_stats
+{
+    uint16_t count;
+    // last value added.
+    int32_t last;
+    int32_t min;
+    int32_t max;
+    // fixed point values (MOTE_STATS_FRACTION_BITS).
+    int32_t ewma;
+    int32_t mean;
+    // fixed point variance (2 * MOTE_STATS_FRACTION_BITS).
+    int64_t variance;
+};
+
+// aggregate of the readings of a sensor during a window of time.
+struct mote_window
+{
+    uint16_t count;
+    int32_t min;
+    int32_t max;
+    int32_t sum;
+};
+
+typedef enum
+{
+    MOTE_ALERT_NONE,
+    MOTE_ALERT_RAISED,
+    MOTE_ALERT_CLEARED,
+} mote_alert_event_t;
+
+struct mote_alert
+{
+    uint8_t active;
+};
+
+void mote_stats_init(struct mote_stats* st);
+
+void mote_stats_update(struct mote_stats* st, int32_t value);
+
+int32_t mote_stats_mean(const struct mote_stats* st);
+
+int32_t mote_stats_ewma(const struct mote_stats* st);
+
+// returns 1 if the value is more than z_limit / 10 standard deviations away
+// from the mean. It is never the case until MOTE_STATS_MIN_SAMPLES are known.
+int mote_stats_is_outlier(const struct mote_stats* st, int32_t value,
+    int z_limit);
+
+void mote_window_init(struct mote_window* w);
+
+void mote_window_update(struct mote_window* w, int32_t value);
+
+// mean of the readings, rounded to the nearest.
+int32_t mote_window_mean(const struct mote_window* w);
+
+void mote_alert_init(struct mote_alert* a);
+
+// raises the alert when it is not active and enter is true, and clears it when
+// it is active and leave is true. The event is only reported on the change.
+mote_alert_event_t mote_alert_update(struct mote_alert* a, int enter,
+    int leave);
+
+#endif /* MOTE_STATS_H */
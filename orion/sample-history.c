@@ -0,0 +1,173 @@
+/*
+ * History of the recent samples of a mote.
+ */
+#include "sample-history.h"
+
+#include <string.h>
+
+// a time delta and a mask, and a varint of 5 bytes at most for each value.
+#define MAX_SAMPLE_LEN (5 + 1 + 5 * SAMPLE_HISTORY_VALUES)
+
+/*---------------------------------------------------------------------------*/
+static uint16_t put_varint(uint8_t* p, uint32_t v)
+{
+    uint16_t len = 0;
+
+    while (v >= 0x80)
+    {
+        p[len++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    p[len++] = v;
+
+    return len;
+}
+/*---------------------------------------------------------------------------*/
+static uint16_t get_varint(const uint8_t* p, uint32_t* v)
+{
+    uint16_t len = 0;
+    uint8_t shift = 0;
+
+    *v = 0;
+
+    do
+    {
+        *v |= (uint32_t)(p[len] & 0x7f) << shift;
+        shift += 7;
+    }
+    while (p[len++] & 0x80);
+
+    return len;
+}
+/*---------------------------------------------------------------------------*/
+// small differences of either sign are encoded in a few bytes.
+static uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+/*---------------------------------------------------------------------------*/
+static int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+/*---------------------------------------------------------------------------*/
+static void start_block(struct sample_history* h, uint8_t index,
+    uint32_t time)
+{
+    struct sample_history_block* b = &h->blocks[index];
+
+    b->start = time;
+    b->len = 0;
+
+    h->head = index;
+    h->last_time = time;
+    memset(h->last, 0, sizeof(h->last));
+}
+/*---------------------------------------------------------------------------*/
+void sample_history_init(struct sample_history* h)
+{
+    h->used = 0;
+    start_block(h, 0, 0);
+}
+/*---------------------------------------------------------------------------*/
+void sample_history_add(struct sample_history* h, uint32_t time, uint8_t mask,
+    const int32_t* values)
+{
+    struct sample_history_block* b = &h->blocks[h->head];
+
+    if (h->used == 0)
+    {
+        start_block(h, h->head, time);
+        h->used = 1;
+    }
+    else if (SAMPLE_HISTORY_BLOCK_SIZE - b->len < MAX_SAMPLE_LEN)
+    {
+        // the oldest block is dropped when all of them are used.
+        start_block(h, (h->head + 1) % SAMPLE_HISTORY_BLOCKS, time);
+        if (h->used < SAMPLE_HISTORY_BLOCKS)
+        {
+            h->used++;
+        }
+    }
+
+    b = &h->blocks[h->head];
+
+    b->len += put_varint(b->data + b->len, time - h->last_time);
+    b->data[b->len++] = mask;
+
+    for (int i = 0; i < SAMPLE_HISTORY_VALUES; i++)
+    {
+        if (mask & (1 << i))
+        {
+            b->len += put_varint(b->data + b->len,
+                zigzag(values[i] - h->last[i]));
+            h->last[i] = values[i];
+        }
+    }
+
+    h->last_time = time;
+}
+/*---------------------------------------------------------------------------*/
+static void cursor_start_block(struct sample_history_cursor* c)
+{
+    c->offset = 0;
+    c->start = c->h->blocks[c->block].start;
+    c->last.time = c->start;
+    memset(c->last.values, 0, sizeof(c->last.values));
+}
+/*---------------------------------------------------------------------------*/
+void sample_history_cursor_init(struct sample_history_cursor* c,
+    const struct sample_history* h)
+{
+    c->h = h;
+    c->blocks_left = h->used;
+    c->block = (h->head + SAMPLE_HISTORY_BLOCKS + 1 - h->used) %
+        SAMPLE_HISTORY_BLOCKS;
+    cursor_start_block(c);
+}
+/*---------------------------------------------------------------------------*/
+int sample_history_next(struct sample_history_cursor* c,
+    struct sample_history_sample* s)
+{
+    const struct sample_history_block* b;
+    uint32_t v;
+
+    while (c->blocks_left > 0 &&
+        c->offset >= c->h->blocks[c->block].len)
+    {
+        c->blocks_left--;
+        c->block = (c->block + 1) % SAMPLE_HISTORY_BLOCKS;
+        cursor_start_block(c);
+    }
+
+    if (c->blocks_left == 0)
+    {
+        return 0;
+    }
+
+    b = &c->h->blocks[c->block];
+
+    if (b->start != c->start)
+    {
+        c->blocks_left = 0;
+        return 0;
+    }
+
+    c->offset += get_varint(b->data + c->offset, &v);
+    c->last.time += v;
+    c->last.mask = b->data[c->offset++];
+
+    for (int i = 0; i < SAMPLE_HISTORY_VALUES; i++)
+    {
+        if (c->last.mask & (1 << i))
+        {
+            c->offset += get_varint(b->data + c->offset, &v);
+            c->last.values[i] += unzigzag(v);
+        }
+    }
+
+    *s = c->last;
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
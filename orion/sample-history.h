@@ -0,0 +1,82 @@
+/*
+ * History of the recent samples of a mote, kept in a ring of fixed size blocks.
+ * Each sample is encoded as the time since the previous one, a mask of the
+ * values it has and, for each of them, its difference with the previous one as
+ * a zigzag varint, so a sample of slowly changing sensors takes a few bytes.
+ * Each block starts from zero, and when all of them are used the oldest one is
+ * dropped at once, so the oldest samples kept can always be decoded.
+ */
+#ifndef SAMPLE_HISTORY_H
+#define SAMPLE_HISTORY_H
+
+#include "contiki.h"
+#include <stdint.h>
+
+// values of each sample, at most 8.
+#ifndef SAMPLE_HISTORY_VALUES
+#define SAMPLE_HISTORY_VALUES 4
+#endif
+
+#ifndef SAMPLE_HISTORY_BLOCK_SIZE
+#define SAMPLE_HISTORY_BLOCK_SIZE 128
+#endif
+
+#ifndef SAMPLE_HISTORY_BLOCKS
+#define SAMPLE_HISTORY_BLOCKS 8
+#endif
+
+struct sample_history_block
+{
+    // time of the first sample, the times of the others are relative to it.
+    uint32_t start;
+    uint16_t len;
+    uint8_t data[SAMPLE_HISTORY_BLOCK_SIZE];
+};
+
+struct sample_history
+{
+    struct sample_history_block blocks[SAMPLE_HISTORY_BLOCKS];
+    // block being written and number of blocks with samples.
+    uint8_t head;
+    uint8_t used;
+    // last sample written to the head block, the next one is encoded from it.
+    uint32_t last_time;
+    int32_t last[SAMPLE_HISTORY_VALUES];
+};
+
+struct sample_history_sample
+{
+    uint32_t time;
+    // bit i is set if values[i] was received.
+    uint8_t mask;
+    int32_t values[SAMPLE_HISTORY_VALUES];
+};
+
+// reads the samples from the oldest to the newest.
+struct sample_history_cursor
+{
+    const struct sample_history* h;
+    uint8_t block;
+    uint8_t blocks_left;
+    uint16_t offset;
+    // start of the block being read, it changes if the block is reused.
+    uint32_t start;
+    struct sample_history_sample last;
+};
+
+void sample_history_init(struct sample_history* h);
+
+// adds a sample, its time (in seconds) can not be older than the last one.
+void sample_history_add(struct sample_history* h, uint32_t time, uint8_t mask,
+    const int32_t* values);
+
+void sample_history_cursor_init(struct sample_history_cursor* c,
+    const struct sample_history* h);
+
+// reads the next sample, returns 0 when there are no more. Samples can be added
+// between reads, but once the block being read is reused for them the reading
+// ends.
+int sample_history_next(struct sample_history_cursor* c,
+    struct sample_history_sample* s);
+
+#endif /* SAMPLE_HISTORY_H */
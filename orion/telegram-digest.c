@@ -0,0 +1,117 @@
+/*
+ * Digest of the Telegram messages to a chat.
+ */
+#include "telegram-digest.h"
+
+#include <stdio.h>
+
+#define DEBUG DEBUG_PRINT
+#include "net/ip/uip-debug.h"
+
+/*---------------------------------------------------------------------------*/
+// starts the json body of a message: {"chat_id":"{id}","text":"
+static void start_body(struct telegram_digest* d)
+{
+    json_writer_init(&d->w, d->body[d->filling], TELEGRAM_DIGEST_SIZE);
+    json_writer_object_start(&d->w);
+    json_writer_key(&d->w, "chat_id");
+    json_writer_string(&d->w, d->chat_id);
+    json_writer_key(&d->w, "text");
+    json_writer_string_start(&d->w);
+    d->count = 0;
+}
+/*---------------------------------------------------------------------------*/
+static uint16_t room(struct telegram_digest* d)
+{
+    return d->w.end - d->w.len;
+}
+/*---------------------------------------------------------------------------*/
+void telegram_digest_init(struct telegram_digest* d, const char* chat_id,
+    clock_time_t window, uint16_t burst, clock_time_t interval)
+{
+    d->chat_id = chat_id;
+    d->filling = 0;
+    d->sending = 0;
+    d->dropped = 0;
+    d->window = window;
+    timer_set(&d->window_timer, 0);
+    token_bucket_init(&d->bucket, burst, interval);
+    start_body(d);
+}
+/*---------------------------------------------------------------------------*/
+struct json_writer* telegram_digest_add(struct telegram_digest* d)
+{
+    if (room(d) < TELEGRAM_DIGEST_MIN_ROOM)
+    {
+        PRINTF("Telegram digest for %s is full, dropping message.\n",
+            d->chat_id);
+        d->dropped++;
+        return NULL;
+    }
+
+    if (d->count == 0)
+    {
+        timer_set(&d->window_timer, d->window);
+    }
+    else
+    {
+        json_writer_escaped(&d->w, "\n\n");
+    }
+
+    d->count++;
+
+    return &d->w;
+}
+/*---------------------------------------------------------------------------*/
+int telegram_digest_ready(struct telegram_digest* d,
+    struct token_bucket* bot_bucket)
+{
+    if (d->sending || (d->count == 0 && d->dropped == 0))
+    {
+        return 0;
+    }
+
+    if (!timer_expired(&d->window_timer) &&
+        room(d) >= TELEGRAM_DIGEST_MIN_ROOM)
+    {
+        return 0;
+    }
+
+    return token_bucket_available(&d->bucket) > 0 &&
+        token_bucket_available(bot_bucket) > 0;
+}
+/*---------------------------------------------------------------------------*/
+const char* telegram_digest_take(struct telegram_digest* d,
+    struct token_bucket* bot_bucket)
+{
+    const char* body = d->body[d->filling];
+
+    if (d->dropped > 0)
+    {
+        json_writer_escaped(&d->w, d->count > 0 ? "\n\n(" : "(");
+        json_writer_int(&d->w, d->dropped);
+        json_writer_escaped(&d->w, " messages dropped)");
+    }
+
+    json_writer_string_end(&d->w);
+    json_writer_object_end(&d->w);
+
+    token_bucket_take(&d->bucket);
+    token_bucket_take(bot_bucket);
+
+    PRINTF("Telegram digest of %u messages for %s.\n", d->count, d->chat_id);
+
+    // the next messages go to the other body.
+    d->sending = 1;
+    d->dropped = 0;
+    d->filling ^= 1;
+    start_body(d);
+
+    return body;
+}
+/*---------------------------------------------------------------------------*/
+void telegram_digest_sent(struct telegram_digest* d)
+{
+    d->sending = 0;
+}
+/*---------------------------------------------------------------------------*/
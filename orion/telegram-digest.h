@@ -0,0 +1,63 @@
+/*
+ * Digest of the Telegram messages to a chat. Messages are merged into a single
+ * one during a window, and the digests are sent within the rate limits of the
+ * chat and of the bot, however many motes there are.
+ */
+#ifndef TELEGRAM_DIGEST_H
+#define TELEGRAM_DIGEST_H
+
+#include "contiki.h"
+#include "json-writer.h"
+#include "token-bucket.h"
+
+// size of the json body of a digest. There are two of them for each chat, one
+// is filled while the other one is being sent.
+#ifndef TELEGRAM_DIGEST_SIZE
+#define TELEGRAM_DIGEST_SIZE 512
+#endif
+
+// room a message needs in a digest, it is dropped if there is less. A digest
+// with less room is sent without waiting for the end of its window.
+#ifndef TELEGRAM_DIGEST_MIN_ROOM
+#define TELEGRAM_DIGEST_MIN_ROOM 128
+#endif
+
+struct telegram_digest
+{
+    const char* chat_id;
+    char body[2][TELEGRAM_DIGEST_SIZE];
+    // writer of the body being filled, inside the text of the message.
+    struct json_writer w;
+    uint8_t filling;
+    // the other body is being sent.
+    uint8_t sending;
+    uint8_t count;
+    uint16_t dropped;
+    // messages are merged until the window of the first one ends.
+    clock_time_t window;
+    struct timer window_timer;
+    struct token_bucket bucket;
+};
+
+// sets up the digest of a chat, with the rate limit of the chat.
+void telegram_digest_init(struct telegram_digest* d, const char* chat_id,
+    clock_time_t window, uint16_t burst, clock_time_t interval);
+
+// starts a new message in the digest and returns the writer its text has to be
+// escaped to, or NULL if there is no room and it is dropped.
+struct json_writer* telegram_digest_add(struct telegram_digest* d);
+
+// whether the digest has to be sent and the rate limits of the chat and of the
+// bot (shared by all the chats) allow it.
+int telegram_digest_ready(struct telegram_digest* d,
+    struct token_bucket* bot_bucket);
+
+// finishes the digest and returns its json body, which is kept until
+// telegram_digest_sent() is called. It takes a token of each rate limit.
+const char* telegram_digest_take(struct telegram_digest* d,
+    struct token_bucket* bot_bucket);
+
+// the body returned by telegram_digest_take() is not needed anymore.
+void telegram_digest_sent(struct telegram_digest* d);
+
+#endif /* TELEGRAM_DIGEST_H */
@@ -0,0 +1,264 @@
+/*
+ * Checks that the documents built by json-writer are valid JSON once closed,
+ * whatever the size of the buffer. It runs on the host with `make tests` in
+ * orion, or `make` here.
+ */
+#include "json-writer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char* p;
+
+static int parse_value(void);
+
+/*---------------------------------------------------------------------------*/
+static int parse_string(void)
+{
+    if (*p++ != '"')
+    {
+        return 0;
+    }
+
+    while (*p != '"')
+    {
+        if (*p == 0 || (unsigned char)*p < 0x20)
+        {
+            return 0;
+        }
+
+        if (*p == '\\')
+        {
+            p++;
+
+            if (*p == 'u')
+            {
+                for (int i = 0; i < 4; i++)
+                {
+                    if (strchr("0123456789abcdefABCDEF", *++p) == NULL ||
+                        *p == 0)
+                    {
+                        return 0;
+                    }
+                }
+            }
+            else if (*p == 0 || strchr("\"\\/bfnrt", *p) == NULL)
+            {
+                return 0;
+            }
+        }
+
+        p++;
+    }
+
+    p++;
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int parse_number(void)
+{
+    const char* start;
+
+    if (*p == '-')
+    {
+        p++;
+    }
+
+    start = p;
+    while (*p >= '0' && *p <= '9')
+    {
+        p++;
+    }
+
+    if (p == start)
+    {
+        return 0;
+    }
+
+    if (*p == '.')
+    {
+        start = ++p;
+        while (*p >= '0' && *p <= '9')
+        {
+            p++;
+        }
+
+        return p > start;
+    }
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int parse_container(char open, char close, int object)
+{
+    if (*p++ != open)
+    {
+        return 0;
+    }
+
+    if (*p == close)
+    {
+        p++;
+        return 1;
+    }
+
+    while (1)
+    {
+        if (object && (!parse_string() || *p++ != ':'))
+        {
+            return 0;
+        }
+
+        if (!parse_value())
+        {
+            return 0;
+        }
+
+        if (*p == close)
+        {
+            p++;
+            return 1;
+        }
+
+        if (*p++ != ',')
+        {
+            return 0;
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+static int parse_value(void)
+{
+    switch (*p)
+    {
+        case '{':
+            return parse_container('{', '}', 1);
+
+        case '[':
+            return parse_container('[', ']', 0);
+
+        case '"':
+            return parse_string();
+
+        case 'n':
+            if (strncmp(p, "null", 4) == 0)
+            {
+                p += 4;
+                return 1;
+            }
+            return 0;
+
+        default:
+            return parse_number();
+    }
+}
+/*---------------------------------------------------------------------------*/
+static int is_valid(const char* json)
+{
+    p = json;
+    return parse_value() && *p == 0;
+}
+/*---------------------------------------------------------------------------*/
+// a document like the ones of the local read endpoint and of sentilo.
+static void write_document(struct json_writer* w)
+{
+    json_writer_object_start(w);
+    json_writer_key(w, "motes");
+    json_writer_array_start(w);
+
+    for (int i = 1; i <= 3; i++)
+    {
+        json_writer_object_start(w);
+        json_writer_key(w, "id");
+        json_writer_int(w, i);
+        json_writer_key(w, "temp");
+        json_writer_fixed(w, -235 * i, 1);
+        json_writer_key(w, "light");
+        json_writer_null(w);
+        json_writer_key(w, "name");
+        json_writer_string(w, "m\"o\\te\n");
+        json_writer_key(w, "samples");
+        json_writer_array_start(w);
+
+        for (int j = 0; j < 3; j++)
+        {
+            json_writer_array_start(w);
+            json_writer_int(w, 1000 * j);
+            json_writer_null(w);
+            json_writer_array_end(w);
+        }
+
+        json_writer_array_end(w);
+        json_writer_object_end(w);
+    }
+
+    json_writer_array_end(w);
+    json_writer_key(w, "next");
+    json_writer_int(w, 1234567);
+    json_writer_object_end(w);
+}
+/*---------------------------------------------------------------------------*/
+int main(void)
+{
+    char buf[512];
+    char full[512];
+    struct json_writer w;
+    int failed = 0;
+
+    json_writer_init(&w, full, sizeof(full));
+    write_document(&w);
+
+    if (json_writer_overflow(&w) || !is_valid(full))
+    {
+        printf("FAIL: whole document '%s'\n", full);
+        failed++;
+    }
+
+    // every size that can hold at least the outer object.
+    for (size_t size = 3; size <= strlen(full) + 1; size++)
+    {
+        json_writer_init(&w, buf, size);
+        write_document(&w);
+
+        if (!is_valid(buf) ||
+            json_writer_overflow(&w) != (size <= strlen(full)))
+        {
+            printf("FAIL: size %u '%s'\n", (unsigned)size, buf);
+            failed++;
+        }
+    }
+
+    // a value that does not fit is taken back with its key or separator.
+    json_writer_init(&w, buf, 12);
+    json_writer_object_start(&w);
+    json_writer_key(&w, "k");
+    json_writer_int(&w, 1234567890);
+    json_writer_object_end(&w);
+
+    if (strcmp(buf, "{}") != 0)
+    {
+        printf("FAIL: key without value '%s'\n", buf);
+        failed++;
+    }
+
+    json_writer_init(&w, buf, 12);
+    json_writer_object_start(&w);
+    json_writer_key(&w, "a");
+    json_writer_array_start(&w);
+    json_writer_int(&w, 1);
+    json_writer_int(&w, 2);
+    json_writer_int(&w, 345);
+    json_writer_array_end(&w);
+    json_writer_object_end(&w);
+
+    if (strcmp(buf, "{\"a\":[1,2]}") != 0)
+    {
+        printf("FAIL: array separator '%s'\n", buf);
+        failed++;
+    }
+
+    printf("%s\n", failed == 0 ? "OK" : "FAILED");
+
+    return failed != 0;
+}
+/*---------------------------------------------------------------------------*/
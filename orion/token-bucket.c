@@ -0,0 +1,53 @@
+/*
+ * Token bucket for limiting the rate of events.
+ */
+#include "token-bucket.h"
+
+/*---------------------------------------------------------------------------*/
+void token_bucket_init(struct token_bucket* b, uint16_t burst,
+    clock_time_t interval)
+{
+    b->tokens = burst;
+    b->burst = burst;
+    b->interval = interval > 0 ? interval : 1;
+    b->last = clock_time();
+}
+/*---------------------------------------------------------------------------*/
+uint16_t token_bucket_available(struct token_bucket* b)
+{
+    clock_time_t now = clock_time();
+    clock_time_t added = (now - b->last) / b->interval;
+
+    if (b->tokens + added >= b->burst)
+    {
+        b->tokens = b->burst;
+        b->last = now;
+    }
+    else
+    {
+        // keep the time since the last token, so none is lost.
+        b->tokens += added;
+        b->last += added * b->interval;
+    }
+
+    return b->tokens;
+}
+/*---------------------------------------------------------------------------*/
+int token_bucket_take(struct token_bucket* b)
+{
+    if (token_bucket_available(b) == 0)
+    {
+        return 0;
+    }
+
+    b->tokens--;
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+void token_bucket_drain(struct token_bucket* b)
+{
+    b->tokens = 0;
+    b->last = clock_time();
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,33 @@
+/*
+ * Token bucket for limiting the rate of events. It holds up to a burst of
+ * tokens and gets a new one every interval, each event takes one.
+ */
+#ifndef TOKEN_BUCKET_H
+#define TOKEN_BUCKET_H
+
+#include "contiki.h"
+#include <stdint.h>
+
+struct token_bucket
+{
+    uint16_t tokens;
+    uint16_t burst;
+    clock_time_t interval;
+    // when the last token was added.
+    clock_time_t last;
+};
+
+// starts full.
+void token_bucket_init(struct token_bucket* b, uint16_t burst,
+    clock_time_t interval);
+
+// tokens available now.
+uint16_t token_bucket_available(struct token_bucket* b);
+
+// takes a token, returns 0 if there is none.
+int token_bucket_take(struct token_bucket* b);
+
+// takes all the tokens, so the next one comes after an interval.
+void token_bucket_drain(struct token_bucket* b);
+
+#endif /* TOKEN_BUCKET_H */
@@ -0,0 +1,288 @@
+/*
+ * Pusher of the readings to a CoAP collector.
+ */
+#include "uplink-coap.h"
+#include "json-writer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define DEBUG DEBUG_PRINT
+#include "net/ip/uip-debug.h"
+
+// room left in a batch for a reading, with its sensor name and value.
+#define MAX_READING_LEN 64
+
+struct batch
+{
+    char buf[UPLINK_COAP_BATCH_SIZE];
+    struct json_writer w;
+    uint16_t count;
+};
+
+static struct batch batch_list[2];
+// readings are added to one batch while the other one is being sent.
+static struct batch* filling = &batch_list[0];
+static struct batch* sending = NULL;
+
+static uip_ipaddr_t collector_addr;
+static uint16_t collector_port;
+static const char* collector_path;
+static uint8_t confirmable;
+
+static coap_packet_t request[1];
+static uint32_t block_num;
+// a block is waiting for its acknowledgement.
+static uint8_t waiting;
+static uint8_t attempts;
+
+static struct timer batch_timer;
+
+static int send_block(void);
+
+/*---------------------------------------------------------------------------*/
+// {"sensors":[{"sensor":"mote_1_temp","observations":[{"value":"23.5"}]},...]}
+static void start_batch(struct batch* b)
+{
+    json_writer_init(&b->w, b->buf, sizeof(b->buf));
+    json_writer_object_start(&b->w);
+    json_writer_key(&b->w, "sensors");
+    json_writer_array_start(&b->w);
+    b->count = 0;
+}
+/*---------------------------------------------------------------------------*/
+static void finish_batch(int sent)
+{
+    if (sent)
+    {
+        PRINTF("CoAP batch of %u readings sent.\n", sending->count);
+    }
+    else
+    {
+        PRINTF("CoAP batch of %u readings dropped.\n", sending->count);
+    }
+
+    sending = NULL;
+}
+/*---------------------------------------------------------------------------*/
+static void batch_failed(void)
+{
+    // it is sent again from the first block when the next one is due.
+    if (++attempts >= UPLINK_COAP_MAX_ATTEMPTS)
+    {
+        finish_batch(0);
+    }
+}
+/*---------------------------------------------------------------------------*/
+static int is_last_block(void)
+{
+    return (block_num + 1) * UPLINK_COAP_BLOCK_SIZE >=
+        json_writer_length(&sending->w);
+}
+/*---------------------------------------------------------------------------*/
+static void block_response(void* data, void* response)
+{
+    uint8_t code;
+
+    waiting = 0;
+
+    if (sending == NULL)
+    {
+        return;
+    }
+
+    if (response == NULL)
+    {
+        PRINTF("CoAP collector did not answer.\n");
+        batch_failed();
+        return;
+    }
+
+    code = ((coap_packet_t*)response)->code;
+
+    // 2.31 Continue or any other success code.
+    if ((code >> 5) != 2)
+    {
+        PRINTF("CoAP batch rejected with %u.%02u.\n", code >> 5, code & 0x1f);
+        finish_batch(0);
+        return;
+    }
+
+    if (is_last_block())
+    {
+        finish_batch(1);
+    }
+    else
+    {
+        block_num++;
+        send_block();
+    }
+}
+/*---------------------------------------------------------------------------*/
+// sends the current block of the batch, returns 0 if it could not be sent.
+static int send_block(void)
+{
+    coap_transaction_t* t;
+    uint16_t len = json_writer_length(&sending->w);
+    uint16_t offset = block_num * UPLINK_COAP_BLOCK_SIZE;
+    uint16_t size = len - offset;
+
+    if (size > UPLINK_COAP_BLOCK_SIZE)
+    {
+        size = UPLINK_COAP_BLOCK_SIZE;
+    }
+
+    coap_init_message(request, confirmable ? COAP_TYPE_CON : COAP_TYPE_NON,
+        COAP_POST, coap_get_mid());
+    coap_set_header_uri_path(request, collector_path);
+    coap_set_header_content_format(request, APPLICATION_JSON);
+
+    if (len > UPLINK_COAP_BLOCK_SIZE)
+    {
+        coap_set_header_block1(request, block_num, !is_last_block(),
+            UPLINK_COAP_BLOCK_SIZE);
+    }
+
+    coap_set_payload(request, sending->buf + offset, size);
+
+    t = coap_new_transaction(request->mid, &collector_addr, collector_port);
+
+    if (t == NULL)
+    {
+        PRINTF("No CoAP transaction available.\n");
+        batch_failed();
+        return 0;
+    }
+
+    // confirmable transactions are kept and sent again until acknowledged,
+    // the others are freed once sent.
+    t->callback = block_response;
+    t->packet_len = coap_serialize_message(request, t->packet);
+    waiting = confirmable;
+
+    coap_send_transaction(t);
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void send_batch(void)
+{
+    block_num = 0;
+
+    if (confirmable)
+    {
+        send_block();
+        return;
+    }
+
+    // nothing is acknowledged, the blocks are sent back to back.
+    while (send_block())
+    {
+        if (is_last_block())
+        {
+            finish_batch(1);
+            break;
+        }
+
+        block_num++;
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void flush(void)
+{
+    struct batch* b = filling;
+
+    if (sending != NULL || b->count == 0)
+    {
+        return;
+    }
+
+    json_writer_array_end(&b->w);
+    json_writer_object_end(&b->w);
+
+    sending = b;
+    attempts = 0;
+
+    filling = b == &batch_list[0] ? &batch_list[1] : &batch_list[0];
+    start_batch(filling);
+
+    timer_set(&batch_timer, UPLINK_COAP_BATCH_PERIOD);
+
+    send_batch();
+}
+/*---------------------------------------------------------------------------*/
+int uplink_coap_init(const char* collector, uint16_t port, const char* path,
+    uint8_t confirm)
+{
+    if (!uiplib_ip6addrconv(collector, &collector_addr))
+    {
+        PRINTF("Invalid CoAP collector address '%s'.\n", collector);
+        return 0;
+    }
+
+    collector_port = port;
+    collector_path = path;
+    confirmable = confirm;
+
+    start_batch(filling);
+    timer_set(&batch_timer, UPLINK_COAP_BATCH_PERIOD);
+
+    coap_init_engine();
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+int uplink_coap_add(const char* sensor, const char* value)
+{
+    struct json_writer* w = &filling->w;
+
+    if (w->end - w->len < MAX_READING_LEN)
+    {
+        // full, send it now if the previous one is already sent.
+        flush();
+        w = &filling->w;
+
+        if (w->end - w->len < MAX_READING_LEN)
+        {
+            PRINTF("CoAP batches are full, dropping reading.\n");
+            return 0;
+        }
+    }
+
+    json_writer_object_start(w);
+    json_writer_key(w, "sensor");
+    json_writer_string(w, sensor);
+    json_writer_key(w, "observations");
+    json_writer_array_start(w);
+    json_writer_object_start(w);
+    json_writer_key(w, "value");
+    json_writer_string(w, value);
+    json_writer_object_end(w);
+    json_writer_array_end(w);
+    json_writer_object_end(w);
+
+    filling->count++;
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+void uplink_coap_periodic(void)
+{
+    if (waiting || !timer_expired(&batch_timer))
+    {
+        return;
+    }
+
+    if (sending != NULL)
+    {
+        // a batch that failed, try it again.
+        timer_set(&batch_timer, UPLINK_COAP_BATCH_PERIOD);
+        send_batch();
+    }
+    else
+    {
+        flush();
+        timer_set(&batch_timer, UPLINK_COAP_BATCH_PERIOD);
+    }
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,45 @@
+/*
+ * Pusher of the readings to a CoAP collector. The readings are batched in the
+ * JSON format of Sentilo and each batch is sent with a block-wise POST over
+ * UDP, so there is no connection to set up and tear down for each reading.
+ */
+#ifndef UPLINK_COAP_H
+#define UPLINK_COAP_H
+
+#include "contiki.h"
+#include "er-coap-engine.h"
+
+// size of a batch. There are two of them, one is filled while the other one
+// is being sent.
+#ifndef UPLINK_COAP_BATCH_SIZE
+#define UPLINK_COAP_BATCH_SIZE 256
+#endif
+
+// maximum time a reading waits in a batch before it is sent.
+#ifndef UPLINK_COAP_BATCH_PERIOD
+#define UPLINK_COAP_BATCH_PERIOD (10 * CLOCK_SECOND)
+#endif
+
+// times a batch is sent before dropping it.
+#ifndef UPLINK_COAP_MAX_ATTEMPTS
+#define UPLINK_COAP_MAX_ATTEMPTS 3
+#endif
+
+// batches longer than a block are sent in several ones (block1 option).
+#define UPLINK_COAP_BLOCK_SIZE REST_MAX_CHUNK_SIZE
+
+// sets the collector, given by its IPv6 address, and the path the batches are
+// posted to. The path is not copied. With confirmable messages each block
+// waits for its acknowledgement, and a batch that is not acknowledged is sent
+// again. Returns 0 if the address is not valid.
+int uplink_coap_init(const char* collector, uint16_t port, const char* path,
+    uint8_t confirmable);
+
+// adds a reading of a sensor to the current batch, returns 0 if it is dropped
+// because both batches are full.
+int uplink_coap_add(const char* sensor, const char* value);
+
+// sends the current batch when due, to be called periodically.
+void uplink_coap_periodic(void);
+
+#endif /* UPLINK_COAP_H */
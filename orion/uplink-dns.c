@@ -0,0 +1,149 @@
+/*
+ * Cache of the addresses of the upstream hosts.
+ */
+#include "uplink-dns.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define DEBUG DEBUG_PRINT
+#include "net/ip/uip-debug.h"
+
+struct uplink_host
+{
+    char name[UPLINK_DNS_MAX_NAME];
+    uip_ipaddr_t addr;
+    uint8_t resolved;
+    uint8_t querying;
+    // when the next lookup is due, or the query times out.
+    struct timer timer;
+};
+
+static struct uplink_host host_list[UPLINK_DNS_MAX_HOSTS];
+static int host_count = 0;
+
+/*---------------------------------------------------------------------------*/
+int uplink_dns_add(const char* url)
+{
+    char name[UPLINK_DNS_MAX_NAME];
+    uip_ip4addr_t ip4addr;
+    uip_ip6addr_t ip6addr;
+    int len = 0;
+    int i;
+
+    if (strncmp(url, "http://", 7) == 0)
+    {
+        url += 7;
+    }
+
+    // ipv6 addresses are written between brackets.
+    if (*url == '[')
+    {
+        return -1;
+    }
+
+    while (url[len] != 0 && url[len] != '/' && url[len] != ':')
+    {
+        if (len == UPLINK_DNS_MAX_NAME - 1)
+        {
+            return -1;
+        }
+
+        name[len] = url[len];
+        len++;
+    }
+
+    name[len] = 0;
+
+    if (len == 0 || uiplib_ip4addrconv(name, &ip4addr) ||
+        uiplib_ip6addrconv(name, &ip6addr))
+    {
+        return -1;
+    }
+
+    for (i = 0; i < host_count; i++)
+    {
+        if (strcmp(host_list[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+
+    if (host_count == UPLINK_DNS_MAX_HOSTS)
+    {
+        PRINTF("No room for resolving host '%s'.\n", name);
+        return -1;
+    }
+
+    strcpy(host_list[host_count].name, name);
+    host_list[host_count].resolved = 0;
+    host_list[host_count].querying = 0;
+    // resolve it as soon as possible.
+    timer_set(&host_list[host_count].timer, 0);
+
+    return host_count++;
+}
+/*---------------------------------------------------------------------------*/
+const uip_ipaddr_t* uplink_dns_get(int handle)
+{
+    if (handle < 0 || handle >= host_count || !host_list[handle].resolved)
+    {
+        return NULL;
+    }
+
+    return &host_list[handle].addr;
+}
+/*---------------------------------------------------------------------------*/
+void uplink_dns_periodic(void)
+{
+    for (int i = 0; i < host_count; i++)
+    {
+        struct uplink_host* h = &host_list[i];
+
+        // a lookup is due, or the last query was not answered. The known
+        // address is still used meanwhile.
+        if (timer_expired(&h->timer))
+        {
+            PRINTF("Resolving host '%s'...\n", h->name);
+
+            h->querying = 1;
+            timer_set(&h->timer, UPLINK_DNS_RETRY_INTERVAL);
+            resolv_query(h->name);
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+void uplink_dns_resolved(const char* name)
+{
+    uip_ipaddr_t* addr;
+
+    for (int i = 0; i < host_count; i++)
+    {
+        struct uplink_host* h = &host_list[i];
+
+        if (!h->querying || strcmp(h->name, name) != 0)
+        {
+            continue;
+        }
+
+        h->querying = 0;
+
+        if (resolv_lookup(name, &addr) == RESOLV_STATUS_CACHED &&
+            addr != NULL)
+        {
+            uip_ipaddr_copy(&h->addr, addr);
+            h->resolved = 1;
+            timer_set(&h->timer, UPLINK_DNS_REFRESH_INTERVAL);
+
+            PRINTF("Host '%s' resolved.\n", name);
+        }
+        else
+        {
+            // keep the last known address, if any, and try again later.
+            timer_set(&h->timer, UPLINK_DNS_RETRY_INTERVAL);
+
+            PRINTF("Host '%s' not resolved.\n", name);
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,41 @@
+/*
+ * Cache of the addresses of the upstream hosts. They are resolved at boot and
+ * refreshed in the background, keeping the last known address meanwhile, so
+ * requests never wait for a DNS lookup.
+ */
+#ifndef UPLINK_DNS_H
+#define UPLINK_DNS_H
+
+#include "contiki-net.h"
+
+#ifndef UPLINK_DNS_MAX_HOSTS
+#define UPLINK_DNS_MAX_HOSTS 3
+#endif
+
+#define UPLINK_DNS_MAX_NAME 40
+
+// time an address is used before resolving its host again. Contiki does not
+// give the TTL of the records, so it is a fixed interval.
+#ifndef UPLINK_DNS_REFRESH_INTERVAL
+#define UPLINK_DNS_REFRESH_INTERVAL (10 * 60 * CLOCK_SECOND)
+#endif
+
+// time to wait before retrying a lookup that failed or was not answered.
+#ifndef UPLINK_DNS_RETRY_INTERVAL
+#define UPLINK_DNS_RETRY_INTERVAL (10 * CLOCK_SECOND)
+#endif
+
+// registers the host of a url and returns its handle, or -1 if the host is an
+// address or there is no room for it. The same host is registered once.
+int uplink_dns_add(const char* url);
+
+// returns the last known address of a host, NULL if not resolved yet.
+const uip_ipaddr_t* uplink_dns_get(int handle);
+
+// starts the lookups that are due, to be called periodically.
+void uplink_dns_periodic(void);
+
+// to be called on each resolv_event_found with the name that was resolved.
+void uplink_dns_resolved(const char* name);
+
+#endif /* UPLINK_DNS_H */
@@ -0,0 +1,214 @@
+/*
+ * Publisher of the uplink data through a MQTT broker.
+ */
+#include "uplink-mqtt.h"
+
+#include "lib/list.h"
+#include "lib/memb.h"
+#include <stdio.h>
+#include <string.h>
+
+#define DEBUG DEBUG_PRINT
+#include "net/ip/uip-debug.h"
+
+struct uplink_mqtt_message
+{
+    struct uplink_mqtt_message* next;
+    char topic[UPLINK_MQTT_TOPIC_LEN];
+    char payload[UPLINK_MQTT_PAYLOAD_LEN];
+    uint16_t payload_len;
+    uint8_t qos;
+    // handed to the client, waiting for it to be sent (QoS 0) or acknowledged
+    // (QoS 1).
+    uint8_t sent;
+    uint16_t mid;
+};
+
+static struct mqtt_connection conn;
+static const char* broker_addr;
+static uint16_t broker_port;
+
+// oldest message first, only the head is being published.
+LIST(message_list);
+MEMB(message_mem, struct uplink_mqtt_message, UPLINK_MQTT_QUEUE_SIZE);
+
+static struct timer reconnect_timer;
+static clock_time_t reconnect_interval;
+
+/*---------------------------------------------------------------------------*/
+static void free_head(void)
+{
+    memb_free(&message_mem, list_pop(message_list));
+}
+/*---------------------------------------------------------------------------*/
+static void connection_lost(void)
+{
+    struct uplink_mqtt_message* m = list_head(message_list);
+
+    // a QoS 0 message may have been lost, a QoS 1 one is published again. The
+    // client picks a new packet id and cannot set DUP, so it is a new publish
+    // for the broker.
+    if (m != NULL && m->sent)
+    {
+        if (m->qos == MQTT_QOS_LEVEL_0)
+        {
+            free_head();
+        }
+        else
+        {
+            m->sent = 0;
+        }
+    }
+}
+/*---------------------------------------------------------------------------*/
+static void mqtt_event(struct mqtt_connection* m, mqtt_event_t event,
+    void* data)
+{
+    struct uplink_mqtt_message* head = list_head(message_list);
+
+    switch (event)
+    {
+        case MQTT_EVENT_CONNECTED:
+            PRINTF("Connected to MQTT broker.\n");
+            reconnect_interval = UPLINK_MQTT_RECONNECT_INTERVAL;
+            uplink_mqtt_update();
+            break;
+
+        case MQTT_EVENT_DISCONNECTED:
+            PRINTF("Disconnected from MQTT broker.\n");
+            connection_lost();
+            break;
+
+        case MQTT_EVENT_PUBACK:
+            if (head != NULL && head->sent &&
+                head->mid == *(uint16_t*)data)
+            {
+                free_head();
+            }
+            uplink_mqtt_update();
+            break;
+
+        case MQTT_EVENT_PUBLISH:
+            // nothing is subscribed.
+            break;
+
+        default:
+            PRINTF("MQTT error %d.\n", event);
+            connection_lost();
+            break;
+    }
+}
+/*---------------------------------------------------------------------------*/
+void uplink_mqtt_init(struct process* app_process, const char* broker,
+    uint16_t port, const char* client_id, const char* username,
+    const char* password)
+{
+    broker_addr = broker;
+    broker_port = port;
+
+    list_init(message_list);
+    memb_init(&message_mem);
+
+    mqtt_register(&conn, app_process, (char*)client_id, mqtt_event,
+        UPLINK_MQTT_MAX_SEGMENT_SIZE);
+
+    if (username != NULL)
+    {
+        mqtt_set_username_password(&conn, (char*)username, (char*)password);
+    }
+
+    // connect as soon as possible.
+    reconnect_interval = UPLINK_MQTT_RECONNECT_INTERVAL;
+    timer_set(&reconnect_timer, 0);
+}
+/*---------------------------------------------------------------------------*/
+int uplink_mqtt_publish(const char* topic, const char* payload, uint8_t qos)
+{
+    struct uplink_mqtt_message* m;
+    size_t payload_len = strlen(payload);
+
+    if (strlen(topic) >= UPLINK_MQTT_TOPIC_LEN ||
+        payload_len >= UPLINK_MQTT_PAYLOAD_LEN)
+    {
+        PRINTF("MQTT message to '%s' too long, dropping it.\n", topic);
+        return 0;
+    }
+
+    m = memb_alloc(&message_mem);
+
+    if (m == NULL)
+    {
+        PRINTF("MQTT queue is full, dropping message.\n");
+        return 0;
+    }
+
+    strcpy(m->topic, topic);
+    memcpy(m->payload, payload, payload_len + 1);
+    m->payload_len = payload_len;
+    m->qos = qos > MQTT_QOS_LEVEL_1 ? MQTT_QOS_LEVEL_1 : qos;
+    m->sent = 0;
+
+    list_add(message_list, m);
+
+    uplink_mqtt_update();
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+void uplink_mqtt_periodic(void)
+{
+    if (mqtt_connected(&conn) || !timer_expired(&reconnect_timer))
+    {
+        return;
+    }
+
+    PRINTF("Connecting to MQTT broker %s...\n", broker_addr);
+
+    // it does nothing if the previous attempt is still going on.
+    mqtt_connect(&conn, (char*)broker_addr, broker_port,
+        UPLINK_MQTT_KEEP_ALIVE);
+
+    timer_set(&reconnect_timer, reconnect_interval);
+
+    reconnect_interval *= 2;
+    if (reconnect_interval > UPLINK_MQTT_RECONNECT_MAX_INTERVAL)
+    {
+        reconnect_interval = UPLINK_MQTT_RECONNECT_MAX_INTERVAL;
+    }
+}
+/*---------------------------------------------------------------------------*/
+void uplink_mqtt_update(void)
+{
+    struct uplink_mqtt_message* m = list_head(message_list);
+
+    // the client takes a single message at a time, the payload and the topic
+    // must be kept until it is ready again.
+    if (m == NULL || !mqtt_ready(&conn))
+    {
+        return;
+    }
+
+    if (m->sent)
+    {
+        if (m->qos != MQTT_QOS_LEVEL_0)
+        {
+            // still waiting for its acknowledgement.
+            return;
+        }
+
+        free_head();
+        m = list_head(message_list);
+
+        if (m == NULL)
+        {
+            return;
+        }
+    }
+
+    if (mqtt_publish(&conn, &m->mid, m->topic, (uint8_t*)m->payload,
+        m->payload_len, m->qos, MQTT_RETAIN_OFF) == MQTT_STATUS_OK)
+    {
+        m->sent = 1;
+    }
+}
+/*---------------------------------------------------------------------------*/
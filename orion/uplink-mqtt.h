@@ -0,0 +1,57 @@
+/*
+ * Publisher of the uplink data through a MQTT broker. A single connection is
+ * kept open and the messages are queued while it is down, so readings are not
+ * sent through a new TCP connection each.
+ */
+#ifndef UPLINK_MQTT_H
+#define UPLINK_MQTT_H
+
+#include "contiki.h"
+#include "mqtt.h"
+
+// messages waiting to be published.
+#ifndef UPLINK_MQTT_QUEUE_SIZE
+#define UPLINK_MQTT_QUEUE_SIZE 8
+#endif
+
+#define UPLINK_MQTT_TOPIC_LEN 48
+#define UPLINK_MQTT_PAYLOAD_LEN 96
+
+// seconds without traffic before the broker is pinged.
+#ifndef UPLINK_MQTT_KEEP_ALIVE
+#define UPLINK_MQTT_KEEP_ALIVE 60
+#endif
+
+// time to wait before connecting again, doubled after each failed attempt up
+// to the maximum.
+#ifndef UPLINK_MQTT_RECONNECT_INTERVAL
+#define UPLINK_MQTT_RECONNECT_INTERVAL (5 * CLOCK_SECOND)
+#endif
+
+#ifndef UPLINK_MQTT_RECONNECT_MAX_INTERVAL
+#define UPLINK_MQTT_RECONNECT_MAX_INTERVAL (5 * 60 * CLOCK_SECOND)
+#endif
+
+#define UPLINK_MQTT_MAX_SEGMENT_SIZE 32
+
+// registers the connection to a broker, given by its IPv6 address (IPv4
+// brokers are reached through NAT64, e.g. ::ffff:c0a8:0101). username can be
+// NULL. The strings are not copied. The mqtt_update events are posted to
+// app_process, which must call uplink_mqtt_update() for each one.
+void uplink_mqtt_init(struct process* app_process, const char* broker,
+    uint16_t port, const char* client_id, const char* username,
+    const char* password);
+
+// queues a message, returns 0 if the queue is full or it is too long. QoS 1
+// messages are kept until the broker acknowledges them and published again
+// after a reconnection, with a new packet id and without the DUP flag as the
+// MQTT client does not allow them; QoS 2 is not supported by the client.
+int uplink_mqtt_publish(const char* topic, const char* payload, uint8_t qos);
+
+// connects to the broker when due, to be called periodically.
+void uplink_mqtt_periodic(void);
+
+// publishes the next queued message if the connection is ready.
+void uplink_mqtt_update(void);
+
+#endif /* UPLINK_MQTT_H */
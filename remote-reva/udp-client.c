@@ -34,9 +34,11 @@
 #include "net/ip/uip-udp-packet.h"
 #include "sys/ctimer.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "dev/serial-line.h"
+#include "runtime-params.h"
 #include "net/ipv6/uip-ds6-route.h"
 
 
@@ -60,7 +62,7 @@
 #endif
 
 // interval of time between each packet send.
-#define SEND_INTERVAL (PERIOD * CLOCK_SECOND)
+#define SEND_INTERVAL (period * CLOCK_SECOND)
 
 // maximum msg
 #define MAX_MSG_LEN 128
@@ -84,11 +86,45 @@
 // define the led that indicates it is sending a test message packet.
 #define TEST_MESSAGE_LED LEDS_BLUE
 
+// times in ms since boot wrap at 31 bits, so they are always parsed as
+// positive numbers.
+#define MS_CLOCK_MASK 0x7fffffff
+
+// round-trip probes: how many are sent by default by the 'probe' command, the
+// time between them and the time to wait for the echo of the last one.
+#ifndef PROBE_COUNT
+#define PROBE_COUNT 20
+#endif
+
+#define PROBE_MAX_COUNT 100
+
+#ifndef PROBE_INTERVAL
+#define PROBE_INTERVAL (CLOCK_SECOND / 2)
+#endif
+
+#ifndef PROBE_TIMEOUT
+#define PROBE_TIMEOUT (2 * CLOCK_SECOND)
+#endif
+
+// rtt of a probe without echo.
+#define PROBE_LOST 0xffff
+
+// the border router echoes the probes as they are.
+#define PROBE_FORMAT "{\"typ\": \"probe\", \"id\": %d, \"n\": %d, \"ts\": %lu}"
+
 // the udp connection.
 static struct uip_udp_conn *client_conn;
 // the server address.
 static uip_ipaddr_t server_ipaddr;
 
+// values of PERIOD and MAX_SEQ_ID, they can be changed at runtime through the
+// serial line (see runtime-params).
+static int32_t period = PERIOD;
+static int32_t max_seq_id = MAX_SEQ_ID;
+
+// timer to send the packets.
+static struct etimer send_packet_timer;
+
 // var to store the current sequence id.
 static int seq_id;
 
@@ -101,16 +137,149 @@ static int last_light;
 static long light_accumulated;
 static int light_read_counter;
 
+// rtt of each probe of the current run in ms, the number of probes of the run
+// (0 when not probing), the next one to send, the ones echoed and when the run
+// started.
+static uint16_t probe_rtt[PROBE_MAX_COUNT];
+static int probe_count;
+static int probe_next;
+static int probe_echoed;
+static unsigned long probe_start;
+static struct etimer probe_timer;
+
+// ms since boot, wrapping at 31 bits.
+static unsigned long get_ms_clock()
+{
+    return (unsigned long)((uint64_t)clock_time() * 1000 / CLOCK_SECOND) &
+        MS_CLOCK_MASK;
+}
+
+// prints the min, mean and 95th percentile of the rtt of the probes echoed,
+// and the ones lost.
+static void report_probes()
+{
+    int received = 0;
+    unsigned long sum = 0;
+
+    // keep the rtts of the echoed probes, sorted.
+    for (int i = 0; i < probe_count; i++)
+    {
+        uint16_t rtt = probe_rtt[i];
+        int j = received;
+
+        if (rtt == PROBE_LOST)
+        {
+            continue;
+        }
+
+        for (; j > 0 && probe_rtt[j - 1] > rtt; j--)
+        {
+            probe_rtt[j] = probe_rtt[j - 1];
+        }
+
+        probe_rtt[j] = rtt;
+        received++;
+        sum += rtt;
+    }
+
+    printf("Probes: %d sent, %d echoed, %d%% lost\n", probe_count, received,
+        100 * (probe_count - received) / probe_count);
+
+    if (received > 0)
+    {
+        printf("RTT: min %u ms, mean %lu ms, p95 %u ms\n", probe_rtt[0],
+            sum / received, probe_rtt[(95 * received + 99) / 100 - 1]);
+    }
+
+    probe_count = 0;
+}
+
+static void probe_echo_received(int n, unsigned long ts)
+{
+    unsigned long rtt = (get_ms_clock() - ts) & MS_CLOCK_MASK;
+
+    // ignore the late echoes of a previous run, and duplicates.
+    if (probe_count == 0 || n < 0 || n >= probe_next ||
+        probe_rtt[n] != PROBE_LOST ||
+        ((ts - probe_start) & MS_CLOCK_MASK) > MS_CLOCK_MASK / 2)
+    {
+        return;
+    }
+
+    probe_rtt[n] = rtt < PROBE_LOST ? rtt : PROBE_LOST - 1;
+    probe_echoed++;
+
+    PRINTF("Probe %d echoed in %lu ms\n", n, rtt);
+
+    // every probe is back, do not wait for the timeout.
+    if (probe_echoed == probe_count)
+    {
+        etimer_stop(&probe_timer);
+        report_probes();
+    }
+}
+
 static void tcpip_handler(void)
 {
     char *str;
+    int id;
+    int n;
+    unsigned long ts;
 
     if (uip_newdata())
     {
         str = uip_appdata;
         str[uip_datalen()] = '\0';
-        printf("DATA recv '%s'\n", str);
+
+        if (sscanf(str, PROBE_FORMAT, &id, &n, &ts) == 3 && id == DEVICE_ID)
+        {
+            probe_echo_received(n, ts);
+        }
+        else
+        {
+            printf("DATA recv '%s'\n", str);
+        }
+    }
+}
+
+static void send_probe()
+{
+    char buf[MAX_MSG_LEN];
+
+    probe_rtt[probe_next] = PROBE_LOST;
+
+    snprintf(buf, MAX_MSG_LEN - 1, PROBE_FORMAT, DEVICE_ID, probe_next,
+        get_ms_clock());
+
+    uip_udp_packet_sendto(client_conn, buf, strlen(buf),
+        &server_ipaddr, UIP_HTONS(UDP_SERVER_PORT));
+
+    probe_next++;
+}
+
+static void start_probes(int count)
+{
+    if (probe_count != 0)
+    {
+        printf("Probes already running\n");
+        return;
     }
+
+    if (count < 1 || count > PROBE_MAX_COUNT)
+    {
+        printf("Probe count must be from 1 to %d\n", PROBE_MAX_COUNT);
+        return;
+    }
+
+    printf("Sending %d probes to the border router\n", count);
+
+    probe_count = count;
+    probe_next = 0;
+    probe_echoed = 0;
+    probe_start = get_ms_clock();
+
+    send_probe();
+    etimer_set(&probe_timer, count > 1 ? PROBE_INTERVAL : PROBE_TIMEOUT);
 }
 
 static void send_packet(void *ptr)
@@ -133,6 +302,8 @@ static void send_packet(void *ptr)
         // else send a data message.
         int temp = 0;
         int hum = 0;
+        // time of the sample, for measuring its latency.
+        unsigned long ts = get_ms_clock();
 
         // activate temp/hum sensor.
         SENSORS_ACTIVATE(dht22);
@@ -159,9 +330,10 @@ static void send_packet(void *ptr)
             // build a data message with temp/hum.
             // -1 because of \0 char.
             snprintf(buf, MAX_MSG_LEN - 1,
-                "{\"id\": %d, \"typ\": \"data\", \"seq\": %d, \"temp\": %d, \"hum\": %d, \"light\": %d, \"batt\": %d}",
+                "{\"id\": %d, \"typ\": \"data\", \"seq\": %d, \"ts\": %lu, \"temp\": %d, \"hum\": %d, \"light\": %d, \"batt\": %d}",
                 DEVICE_ID,
                 seq_id,
+                ts,
                 temp,
                 hum,
                 last_light,
@@ -174,9 +346,10 @@ static void send_packet(void *ptr)
 
             // -1 because of \0 char.
             snprintf(buf, MAX_MSG_LEN - 1,
-                "{\"id\": %d, \"typ\": \"data\", \"seq\": %d, \"temp\": \"%s\", \"hum\": \"%s\", \"light\": %d, \"batt\": %d}",
+                "{\"id\": %d, \"typ\": \"data\", \"seq\": %d, \"ts\": %lu, \"temp\": \"%s\", \"hum\": \"%s\", \"light\": %d, \"batt\": %d}",
                 DEVICE_ID,
                 seq_id,
+                ts,
                 "error",
                 "error",
                 last_light,
@@ -184,7 +357,7 @@ static void send_packet(void *ptr)
         }
 
         // update sequence id.
-        if (seq_id >= MAX_SEQ_ID)
+        if (seq_id >= max_seq_id)
         {
             // if seq_id exceeds the limit, restart it.
             seq_id = 1;
@@ -253,17 +426,37 @@ static void print_app_config()
     PRINTF("= APP config                                                =\n");
     PRINTF("=============================================================\n");
     PRINTF("Device ID:                   %d\n", DEVICE_ID);
-    PRINTF("Packet sending period time:  %d seconds\n", PERIOD);
-    PRINTF("Maximum sequence ID:         %d\n", MAX_SEQ_ID);
+    PRINTF("Packet sending period time:  %ld seconds\n", (long)period);
+    PRINTF("Maximum sequence ID:         %ld\n", (long)max_seq_id);
     PRINTF("=============================================================\n");
 }
 
+static void period_changed(const struct runtime_param* p)
+{
+    // the next packet is sent one new period from now.
+    etimer_set(&send_packet_timer, SEND_INTERVAL);
+}
+
+static void max_seq_id_changed(const struct runtime_param* p)
+{
+    if (seq_id > max_seq_id)
+    {
+        seq_id = 1;
+    }
+}
+
+// settings that can be changed through the serial line.
+static const struct runtime_param app_params[] =
+{
+    {"period", &period, 1, 24 * 60 * 60, period_changed},
+    {"max_seq", &max_seq_id, 1, 32767, max_seq_id_changed},
+};
+
 PROCESS(udp_client_process, "UDP client process");
 AUTOSTART_PROCESSES(&udp_client_process);
 
 PROCESS_THREAD(udp_client_process, ev, data)
 {
-    static struct etimer send_packet_timer;
     static struct ctimer test_msg_led_timer;
     static struct etimer light_timer;
 
@@ -293,14 +486,19 @@ PROCESS_THREAD(udp_client_process, ev, data)
     PRINTF(" local/remote port %u/%u\n",
            UIP_HTONS(client_conn->lport), UIP_HTONS(client_conn->rport));
 
-    print_app_config();
-
     // initialize some vars.
     f_send_test_msg = 0;
 
     // initialize packets sequence id.
     seq_id = 1;
 
+    probe_count = 0;
+
+    // load the stored settings, if any.
+    runtime_params_init(app_params, sizeof(app_params) / sizeof(app_params[0]));
+
+    print_app_config();
+
     light_accumulated = 0;
     light_read_counter = 0;
 
@@ -334,6 +532,23 @@ PROCESS_THREAD(udp_client_process, ev, data)
                 send_packet(NULL);
             }
         }
+        else if (ev == serial_line_event_message && data != NULL)
+        {
+            const char* command = (const char*)data;
+
+            // a command to measure the rtt to the border router, or to get or
+            // change the settings.
+            if (strncmp(command, "probe", 5) == 0 &&
+                (command[5] == '\0' || command[5] == ' '))
+            {
+                start_probes(command[5] == ' ' ? atoi(command + 6) :
+                    PROBE_COUNT);
+            }
+            else if (!runtime_params_handle_command(command))
+            {
+                printf("Unknown command\n");
+            }
+        }
 
         if (etimer_expired(&send_packet_timer))
         {
@@ -341,6 +556,22 @@ PROCESS_THREAD(udp_client_process, ev, data)
             send_packet(NULL);
         }
 
+        if (probe_count != 0 && etimer_expired(&probe_timer))
+        {
+            if (probe_next < probe_count)
+            {
+                send_probe();
+
+                // after the last one, wait for its echo.
+                etimer_set(&probe_timer, probe_next < probe_count ?
+                    PROBE_INTERVAL : PROBE_TIMEOUT);
+            }
+            else
+            {
+                report_probes();
+            }
+        }
+
         if (etimer_expired(&light_timer))
         {
             etimer_reset(&light_timer);
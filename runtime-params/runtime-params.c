@@ -0,0 +1,285 @@
+/*
+ * Parameters that can be read and changed at runtime through the serial line.
+ */
+#include "contiki.h"
+#include "runtime-params.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if RUNTIME_PARAMS_WITH_CFS
+#include "cfs/cfs.h"
+#endif
+
+static const struct runtime_param *param_list = NULL;
+static int param_count = 0;
+
+/*---------------------------------------------------------------------------*/
+static const struct runtime_param *
+find_param(const char *name, int len)
+{
+    int i;
+
+    for (i = 0; i < param_count; i++)
+    {
+        if (strncmp(param_list[i].name, name, len) == 0 &&
+            param_list[i].name[len] == 0)
+        {
+            return &param_list[i];
+        }
+    }
+
+    return NULL;
+}
+/*---------------------------------------------------------------------------*/
+static int
+set_param(const struct runtime_param *p, int32_t value)
+{
+    if (value < p->min || value > p->max)
+    {
+        return 0;
+    }
+
+    if (p->check != NULL && !p->check(p, value))
+    {
+        return 0;
+    }
+
+    if (*p->value != value)
+    {
+        *p->value = value;
+
+        if (p->on_change != NULL)
+        {
+            p->on_change(p);
+        }
+    }
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_param(const struct runtime_param *p)
+{
+    printf("%s = %ld (%ld..%ld)\n", p->name, (long)*p->value,
+        (long)p->min, (long)p->max);
+}
+/*---------------------------------------------------------------------------*/
+// parses the "<name> <value>" lines of a command or of the stored file.
+static int
+parse_assignment(const char *str, int verbose)
+{
+    const struct runtime_param *p;
+    const char *value;
+    char *end;
+    long v;
+
+    value = strchr(str, ' ');
+
+    if (value == NULL)
+    {
+        return 0;
+    }
+
+    p = find_param(str, value - str);
+
+    if (p == NULL)
+    {
+        if (verbose)
+        {
+            printf("Unknown parameter\n");
+        }
+
+        return 0;
+    }
+
+    v = strtol(value + 1, &end, 10);
+
+    // the whole value must be a number, "30abc" is not 30.
+    if (end == value + 1 || *end != 0 || v < p->min || v > p->max)
+    {
+        if (verbose)
+        {
+            printf("Invalid value, range is %ld..%ld\n",
+                (long)p->min, (long)p->max);
+        }
+
+        return 0;
+    }
+
+    if (!set_param(p, v))
+    {
+        if (verbose)
+        {
+            printf("Invalid value with the other parameters\n");
+        }
+
+        return 0;
+    }
+
+    if (verbose)
+    {
+        print_param(p);
+    }
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
+#if RUNTIME_PARAMS_WITH_CFS
+static void
+load_params(void)
+{
+    static char buf[RUNTIME_PARAMS_MAX_FILE];
+    char *line;
+    int fd;
+    int len;
+    int i;
+
+    fd = cfs_open(RUNTIME_PARAMS_FILENAME, CFS_READ);
+
+    if (fd < 0)
+    {
+        return;
+    }
+
+    len = cfs_read(fd, buf, sizeof(buf) - 1);
+    cfs_close(fd);
+
+    if (len <= 0)
+    {
+        return;
+    }
+
+    buf[len] = 0;
+
+    for (line = buf; *line != 0; line++)
+    {
+        if (*line == '\n')
+        {
+            *line = 0;
+        }
+    }
+
+    // a value checked against another parameter can be rejected before that
+    // one is loaded, the second pass sets it.
+    for (i = 0; i < 2; i++)
+    {
+        for (line = buf; line < buf + len; line += strlen(line) + 1)
+        {
+            parse_assignment(line, 0);
+        }
+    }
+
+    printf("Loaded parameters from flash\n");
+}
+#endif
+/*---------------------------------------------------------------------------*/
+void
+runtime_params_init(const struct runtime_param *params, int count)
+{
+    param_list = params;
+    param_count = count;
+
+#if RUNTIME_PARAMS_WITH_CFS
+    load_params();
+#endif
+}
+/*---------------------------------------------------------------------------*/
+int
+runtime_params_set(const char *name, int32_t value)
+{
+    const struct runtime_param *p = find_param(name, strlen(name));
+
+    return p != NULL && set_param(p, value);
+}
+/*---------------------------------------------------------------------------*/
+int
+runtime_params_save(void)
+{
+#if RUNTIME_PARAMS_WITH_CFS
+    char line[RUNTIME_PARAMS_MAX_LINE];
+    int fd;
+    int len;
+    int i;
+
+    cfs_remove(RUNTIME_PARAMS_FILENAME);
+    fd = cfs_open(RUNTIME_PARAMS_FILENAME, CFS_WRITE);
+
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < param_count; i++)
+    {
+        len = snprintf(line, sizeof(line), "%s %ld\n",
+            param_list[i].name, (long)*param_list[i].value);
+
+        if (len >= sizeof(line) || cfs_write(fd, line, len) != len)
+        {
+            cfs_close(fd);
+            return 0;
+        }
+    }
+
+    cfs_close(fd);
+
+    return 1;
+#else
+    return 0;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+int
+runtime_params_handle_command(const char *line)
+{
+    const struct runtime_param *p;
+    int i;
+
+    if (strcmp(line, "params") == 0)
+    {
+        for (i = 0; i < param_count; i++)
+        {
+            print_param(&param_list[i]);
+        }
+    }
+    else if (strncmp(line, "get ", 4) == 0)
+    {
+        p = find_param(line + 4, strlen(line + 4));
+
+        if (p != NULL)
+        {
+            print_param(p);
+        }
+        else
+        {
+            printf("Unknown parameter\n");
+        }
+    }
+    else if (strncmp(line, "set ", 4) == 0)
+    {
+        parse_assignment(line + 4, 1);
+    }
+    else if (strcmp(line, "save") == 0)
+    {
+        printf(runtime_params_save() ? "Parameters saved\n" :
+            "Parameters could not be saved\n");
+    }
+    else if (strcmp(line, "erase") == 0)
+    {
+#if RUNTIME_PARAMS_WITH_CFS
+        cfs_remove(RUNTIME_PARAMS_FILENAME);
+        printf("Stored parameters erased\n");
+#else
+        printf("Parameters are not stored\n");
+#endif
+    }
+    else
+    {
+        return 0;
+    }
+
+    return 1;
+}
+/*---------------------------------------------------------------------------*/
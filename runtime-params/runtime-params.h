@@ -0,0 +1,68 @@
+/*
+ * Parameters that can be read and changed at runtime through the serial line,
+ * optionally stored in flash so they survive a reboot.
+ *
+ * Commands (one per line):
+ *   params               lists all the parameters and their values.
+ *   get <name>           prints the value of a parameter.
+ *   set <name> <value>   changes the value of a parameter.
+ *   save                 stores the current values in flash.
+ *   erase                removes the stored values, defaults are used after
+ *                        the next reboot.
+ */
+#ifndef RUNTIME_PARAMS_H
+#define RUNTIME_PARAMS_H
+
+#include <stdint.h>
+
+// store the values in flash through CFS (Coffee must be enabled).
+#ifdef RUNTIME_PARAMS_CONF_WITH_CFS
+#define RUNTIME_PARAMS_WITH_CFS RUNTIME_PARAMS_CONF_WITH_CFS
+#else
+#define RUNTIME_PARAMS_WITH_CFS 0
+#endif
+
+#ifdef RUNTIME_PARAMS_CONF_FILENAME
+#define RUNTIME_PARAMS_FILENAME RUNTIME_PARAMS_CONF_FILENAME
+#else
+#define RUNTIME_PARAMS_FILENAME "params"
+#endif
+
+// maximum length of a command or of the stored file.
+#define RUNTIME_PARAMS_MAX_LINE 32
+#define RUNTIME_PARAMS_MAX_FILE 512
+
+struct runtime_param;
+
+typedef void (*runtime_param_callback_t)(const struct runtime_param *p);
+typedef int (*runtime_param_check_t)(const struct runtime_param *p,
+    int32_t value);
+
+struct runtime_param
+{
+    const char *name;
+    int32_t *value;
+    int32_t min;
+    int32_t max;
+    // called after the value has changed, can be NULL.
+    runtime_param_callback_t on_change;
+    // called before changing the value, which is rejected if it returns 0
+    // (e.g. a minimum over its maximum), can be NULL.
+    runtime_param_check_t check;
+};
+
+// registers the table of parameters, which must stay alive, and loads the
+// stored values if any.
+void runtime_params_init(const struct runtime_param *params, int count);
+
+// handles a line received through the serial line. Returns 1 if it was a
+// command, 0 otherwise.
+int runtime_params_handle_command(const char *line);
+
+// changes the value of a parameter. Returns 1 if done, 0 if the parameter does
+// not exist, the value is out of its range or its check rejects it.
+int runtime_params_set(const char *name, int32_t value);
+
+int runtime_params_save(void);
+
+#endif /* RUNTIME_PARAMS_H */